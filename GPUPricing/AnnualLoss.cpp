@@ -4,6 +4,11 @@
 #include <omp.h>
 #include <algorithm>
 #include <functional>
+#include <cmath>
+#include <climits>
+
+#include "Reduction.h"
+#include "Log.h"
 
 namespace VCAPS
 {
@@ -13,7 +18,7 @@ void AnnualLoss::addAnnualLoss(AnnualLoss& newAnnualLoss)
 {
   if(newAnnualLoss.get_numIter() != _numIter) {
     if(_numIter == 0 || newAnnualLoss.get_numIter() ==0) {
-      int numCorrect = _numIter;
+      VLONG numCorrect = _numIter;
       if(numCorrect < newAnnualLoss.get_numIter())
         numCorrect = newAnnualLoss.get_numIter();
       _numIter = numCorrect;
@@ -22,124 +27,168 @@ void AnnualLoss::addAnnualLoss(AnnualLoss& newAnnualLoss)
       exit(0);
     }
   }
-  for(int k = 0; k < _numIter; k++)
+  for(VLONG k = 0; k < _numIter; k++)
     _annualLoss[k] += newAnnualLoss.getAnnualLoss(k);
-  _sortedInAllocatedTVaRSeries=false;
+  _index.reset();
 }
 
 void AnnualLoss::setAnnualLoss(VECTOR& losses)
 {
-  for (int y = 0; y<(int)losses.size(); y++)
+  for (size_t y = 0; y < losses.size(); y++)
     _annualLoss[y] = losses[y];
-  _sortedInAllocatedTVaRSeries = false;
+  _index.reset();
 }
 
 void AnnualLoss::setAnnualLoss(VECTOR& losses, VECTOR& grosses)
 {
-  for (int y = 0; y < _numIter; y++) {
+  for (VLONG y = 0; y < _numIter; y++) {
     _annualLoss[y] = losses[y];
     _annualLossGross[y] = grosses[y];
   }
-  _sortedInAllocatedTVaRSeries = false;
+  _index.reset();
 }
 
-double AnnualLoss::getAnnualLoss(int iterId)
+double AnnualLoss::getAnnualLoss(VLONG iterId) const
 {
-  Iterator i = _annualLoss.find(iterId);
+  MAP::const_iterator i = _annualLoss.find(iterId);
   if(i == _annualLoss.end()) return 0.; 
   return i->second;
 }
 
-double AnnualLoss::get_expectedLoss()
+void AnnualLoss::_buildIndex() const
+{
+  size_t N = _annualLoss.size(), j = 0;
+  _sortedAnnualLoss.resize(N);
+  for(MAP::const_iterator i = _annualLoss.begin(); i != _annualLoss.end(); i++, j++)
+    _sortedAnnualLoss[j] = pair<double, VLONG>( - i->second, i->first);
+  sort(_sortedAnnualLoss.begin(), _sortedAnnualLoss.end());
+
+  _sortedSums.resize(N + 1);
+  _sortedSums[0] = 0;
+  for (size_t i = 0; i < N; i++)
+    _sortedSums[i + 1] = _sortedSums[i] - _sortedAnnualLoss[i].first;
+  _expectedLoss = _numIter > 0 ? _sortedSums[N] / (double)_numIter : 0.;
+}
+
+void AnnualLoss::freeze() const
 {
-  double expectedLoss = 0.;
-  for (Iterator it = _annualLoss.begin(); it != _annualLoss.end(); it++)
-    expectedLoss += it->second;
- 
-  expectedLoss /= (double)_numIter;
-  return expectedLoss;
+  _index.call([this]() { _buildIndex(); });
+}
+
+double AnnualLoss::get_expectedLoss() const
+{
+  freeze();
+  return _expectedLoss;
 }
 
 bool UDgreater(double elem1, double elem2){return elem1 > elem2; }
-double AnnualLoss::getAllocatedTVaRSeries(AnnualLoss& contributor,
-            vector<double> probs, bool removeMean)
+double AnnualLoss::getAllocatedTVaRSeries(const AnnualLoss& contributor,
+            vector<double> probs, bool removeMean) const
 {
-  double meanContributing = 0;
+  freeze();
+  double meanBase = 0, meanContributing = 0;
   if(removeMean) {
-    if (!_sortedInAllocatedTVaRSeries)
-      _meanBase = get_expectedLoss();
+    meanBase = _expectedLoss;
     meanContributing = contributor.get_expectedLoss();
   }
 
-  int N = (int)_annualLoss.size(),
-      j = 0;
-  if (!_sortedInAllocatedTVaRSeries) {
-    _sortedAnnualLoss.resize(N);
-    for(Iterator i = _annualLoss.begin(); i != _annualLoss.end(); i++, j++)
-      _sortedAnnualLoss[j] = pair<double, int>( - i->second, i->first);
-
-    sort(_sortedAnnualLoss.begin(), _sortedAnnualLoss.end());
-    _baseWeightedTVaR = 0;
-  }
-
-  double contributingWeightedTVaR = 0;
+  VLONG N = (VLONG)_annualLoss.size();
+  double baseWeightedTVaR = 0, contributingWeightedTVaR = 0;
   // make big prob first to reuse the calculated sum, it will not rewrite
   //    the input probs after return
   sort(probs.begin(), probs.end(), UDgreater);
-  int i=0;
-  double baseTVaR = 0, contributedTVaR = 0;
-  for(int k = 0; k < (int)probs.size(); k++) {
+  VLONG i=0;
+  double contributedTVaR = 0;
+  for(size_t k = 0; k < probs.size(); k++) {
     double aep = 0;
-    int nPos = probabilityToIndex(_numIter, probs[k]);
+    VLONG nPos = probabilityToIndex(_numIter, probs[k]);
     if(nPos < 1) nPos = 1;
-    if(nPos <= (int)_annualLoss.size())
+    if(nPos <= (VLONG)_annualLoss.size())
       aep = - _sortedAnnualLoss[nPos-1].first;
 
     // the sum for the next prob start from the end of the first
-    for(/*int i = 0*/; i< N; i++) {
+    for(/*VLONG i = 0*/; i< N; i++) {
       if( - _sortedAnnualLoss[i].first < aep-0.00000001)
         break;
-      if (!_sortedInAllocatedTVaRSeries)
-        baseTVaR += - _sortedAnnualLoss[i].first - _meanBase;
       double contributor_loss = contributor.getAnnualLoss(_sortedAnnualLoss[i].second);
-      //if (i < 10) {
-      //  cerr << i << ":" << contributor_loss << ":" 
-      //    << _sortedAnnualLoss[i].second << ":" << _sortedAnnualLoss[i].first << endl;
-      //}
       contributedTVaR += contributor_loss - meanContributing;
     }
-    if (!_sortedInAllocatedTVaRSeries)
-      _baseWeightedTVaR += baseTVaR/double(nPos) * probs[k];
+    double baseTVaR = _sortedSums[i] - i * meanBase;
+    baseWeightedTVaR += baseTVaR/double(nPos) * probs[k];
     contributingWeightedTVaR += contributedTVaR/double(nPos) * probs[k];
   }
 
-  _sortedInAllocatedTVaRSeries=true;
+  VCAPS_LOG(LOG_DEBUG, "AnnualLoss::getAllocatedTVaRSeries " 
+    << contributingWeightedTVaR << "/" << baseWeightedTVaR 
+    << ":" << meanContributing << ":" << meanBase);
+
+  return (abs(baseWeightedTVaR) <= 0.00001) ? 0 : contributingWeightedTVaR/baseWeightedTVaR;
+}
 
-  cout << "AnnualLoss::getAllocatedTVaRSeries " 
-    << contributingWeightedTVaR << "/" << _baseWeightedTVaR 
-    << ":" << meanContributing << ":" << _meanBase << endl;
+static VLONG tailSize(VLONG numIter, double prob)
+{
+  return (std::max)((VLONG)1, (VLONG)(numIter * prob + 0.5));
+}
 
-  return (abs(_baseWeightedTVaR) <= 0.00001) ? 0 : contributingWeightedTVaR/_baseWeightedTVaR;
+// the years without loss count as zeros, between the positive and the
+//  negative losses of the sorted index
+static VLONG positiveCount(const vector< pair<double, VLONG> >& sorted)
+{
+  return lower_bound(sorted.begin(), sorted.end(), pair<double, VLONG>(0., LLONG_MIN)) - sorted.begin();
+}
+
+double AnnualLoss::getQuantile(double prob) const
+{
+  if (_numIter == 0)
+    return 0.;
+  freeze();
+  VLONG n = tailSize(_numIter, prob), positive = positiveCount(_sortedAnnualLoss);
+  VLONG size = (VLONG)_sortedAnnualLoss.size(), zeros = (std::max)((VLONG)0, _numIter - size);
+  if (n <= positive)
+    return - _sortedAnnualLoss[n - 1].first;
+  if (n <= positive + zeros)
+    return 0.;
+  return - _sortedAnnualLoss[(std::min)(n - zeros, size) - 1].first;
+}
+
+double AnnualLoss::getTVaR(double prob) const
+{
+  if (_numIter == 0)
+    return 0.;
+  freeze();
+  VLONG n = tailSize(_numIter, prob), positive = positiveCount(_sortedAnnualLoss);
+  VLONG size = (VLONG)_sortedAnnualLoss.size(), zeros = (std::max)((VLONG)0, _numIter - size);
+  VLONG k = n <= positive ? n : (std::max)(positive, n - zeros);
+  return _sortedSums[(std::min)(k, size)] / n;
 }
 
 void AnnualLoss::scale(double scaleFactor)
 {
   for(Iterator i = _annualLoss.begin(); i != _annualLoss.end(); i++)
     i->second *= scaleFactor;
-  _sortedInAllocatedTVaRSeries=false;
+  _index.reset();
 }
 
-pair<double, double> AnnualLoss::get_expected_sd()
+pair<double, double> AnnualLoss::get_expected_sd() const
 {
-  double totalLoss = 0., t2 = 0.;
-  for (Iterator it = _annualLoss.begin(); it != _annualLoss.end(); it++) {
-    totalLoss += it->second;
-    t2 += it->second * it->second;
-  }
-  double expectedLoss = totalLoss / _numIter;
-  double variance = (std::max)(0.0, t2 / _numIter - expectedLoss*expectedLoss);
-  double sd = sqrt(variance);
-  return pair<double, double>(expectedLoss, sd);
+  if (_numIter == 0)
+    return pair<double, double>(0., 0.);
+
+  // iteration order of the hash map depends on its insertion history, so
+  //  the deterministic mode reduces the losses in iteration ID order
+  vector< pair<VLONG, double> > keyed(_annualLoss.begin(), _annualLoss.end());
+  if (Reduction::isDeterministic())
+    sort(keyed.begin(), keyed.end());
+
+  long n = (long)keyed.size();
+  vector<double> losses(n);
+#pragma omp parallel for schedule(static)
+  for (long i = 0; i < n; i++)
+    losses[i] = keyed[i].second;
+
+  Moments m = Reduction::moments(losses);
+  m.normalize((double)_numIter);
+  return pair<double, double>(m.mean, sqrt(m.variance()));
 }
 
 }
@@ -5,97 +5,108 @@
 #include <unordered_map>
 #include <iterator>
 
+#include "OnceFlag.h"
+
 using namespace std;
 
 namespace VCAPS
 {
 
+typedef long long VLONG; // as in VirtualEvent.h
+
 /*
   this class is used primarily for calculating allocated TVaR to a contract
-  in a computationally efficient way than using the Simulation class
+  in a computationally efficient way than using the Simulation class.
+  The const queries build the sorted index they need once, under a once
+  flag, so after the last modification (or freeze()) one instance can be
+  queried from many threads; the modifiers must not run concurrently with
+  anything else
 */
 class AnnualLoss
 {
 public:
   typedef vector<double> VECTOR;
-  typedef unordered_map<int, double> MAP;
-  typedef unordered_map<int, double>::iterator Iterator;
+  typedef unordered_map<VLONG, double> MAP;
+  typedef unordered_map<VLONG, double>::iterator Iterator;
 
 public:
-  AnnualLoss(int numIter=0)
+  AnnualLoss(VLONG numIter=0)
     : _numIter(numIter), 
-      _sortedInAllocatedTVaRSeries(false),
-      _meanBase(0),
-      _baseWeightedTVaR(0)
+      _expectedLoss(0)
   { }
-  AnnualLoss(MAP& annualLoss, int numIter)
+  AnnualLoss(MAP& annualLoss, VLONG numIter)
     : _annualLoss(annualLoss), 
       _numIter(numIter),
-      _sortedInAllocatedTVaRSeries(false),
-      _meanBase(0),
-      _baseWeightedTVaR(0)
+      _expectedLoss(0)
   {}
-  AnnualLoss(MAP& annualLoss, MAP& annualLossGross, int numIter)
+  AnnualLoss(MAP& annualLoss, MAP& annualLossGross, VLONG numIter)
     : _annualLoss(annualLoss), 
       _annualLossGross(annualLossGross),
       _numIter(numIter),
-      _sortedInAllocatedTVaRSeries(false),
-      _meanBase(0),
-      _baseWeightedTVaR(0)
+      _expectedLoss(0)
   {}
-  void set_numIter(int x) { _numIter = x; }
-  int get_numIter() { return _numIter; }
-  int size() { return (int)_annualLoss.size(); }
-  void addAnnualLoss(int iterId, double x) { 
-    _annualLoss[iterId] += x; _sortedInAllocatedTVaRSeries=false;
+  void set_numIter(VLONG x) { _numIter = x; _index.reset(); }
+  VLONG get_numIter() const { return _numIter; }
+  size_t size() const { return _annualLoss.size(); }
+  void addAnnualLoss(VLONG iterId, double x) { 
+    _annualLoss[iterId] += x; _index.reset();
   }
-  void addAnnualLoss(int iterId, double x, double y) {
+  void addAnnualLoss(VLONG iterId, double x, double y) {
     _annualLoss[iterId] += x;
     _annualLossGross[iterId] += y;
-    _sortedInAllocatedTVaRSeries=false;
+    _index.reset();
   }
   void addAnnualLoss(AnnualLoss& newAnnualLoss);
   void setAnnualLoss(VECTOR& losses);
   void setAnnualLoss(VECTOR& losses, VECTOR& grosses);
-  double getAnnualLoss(int iterId);
-  double getQuantile(double prob);
-  void clear() { _annualLoss.clear(); _sortedInAllocatedTVaRSeries=false;}
+  double getAnnualLoss(VLONG iterId) const;
+  /*
+    prob is the exceedance probability (0.004 for 1 in 250 years):
+    the quantile is the n-th largest annual loss and the TVaR the mean of
+    the n largest, n = round(numIter * prob) but at least 1
+  */
+  double getQuantile(double prob) const;
+  void clear() { _annualLoss.clear(); _index.reset(); }
   void scale(double scaleFactor);
+  // builds the index of the queries now rather than on the first one
+  void freeze() const;
 
   void swap(AnnualLoss& other){
     _annualLoss.swap(other._annualLoss);
     _annualLossGross.swap(other._annualLossGross);
     _sortedLoss.swap(other._sortedLoss);
     std::swap(_numIter, other._numIter);
-    _sortedAnnualLoss.swap(other._sortedAnnualLoss);
-    std::swap(_sortedInAllocatedTVaRSeries, other._sortedInAllocatedTVaRSeries);
-    std::swap(_meanBase, other._meanBase);
-    std::swap(_baseWeightedTVaR, other._baseWeightedTVaR);
+    _index.reset();
+    other._index.reset();
   }
 
-  int probabilityToIndex(int numIter, double prob) {
-    int nReverse = (int)(numIter * prob + 0.5);
-    return numIter - (std::min)(1, nReverse);
+  VLONG probabilityToIndex(VLONG numIter, double prob) const {
+    VLONG nReverse = (VLONG)(numIter * prob + 0.5);
+    return numIter - (std::min)((VLONG)1, nReverse);
   }
 
   /*
     calculate the contribution by the "contributor" to the TVaRs (speicified
     by probs) of this instance
   */
-  double getAllocatedTVaRSeries(AnnualLoss& contributor, vector<double> probs,
-        bool removeMean=1);
+  double getAllocatedTVaRSeries(const AnnualLoss& contributor, vector<double> probs,
+        bool removeMean=1) const;
 
-  double get_expectedLoss();
+  double get_expectedLoss() const;
   void addConstant(double x);
   double get_sd();
-  pair<double, double> get_expected_sd();
-  double getTVaR(double prob);
-  bool empty() { return _annualLoss.size()==0; }
+  pair<double, double> get_expected_sd() const;
+  double getTVaR(double prob) const;
+  bool empty() const { return _annualLoss.size()==0; }
 
-  MAP& get_annualLoss() { return _annualLoss; }
+  // the non-const accessors are for filling the losses in place
+  MAP& get_annualLoss() { _index.reset(); return _annualLoss; }
   MAP& get_annualLossGross() { return _annualLossGross; }
+  const MAP& get_annualLoss() const { return _annualLoss; }
+  const MAP& get_annualLossGross() const { return _annualLossGross; }
 
 private:
+  void _buildIndex() const;
 
   /*
     key = iteration ID
@@ -107,13 +118,17 @@ private:
     key = annual loss
     value = iteration ID
   */
-  multimap<double, int> _sortedLoss;
-  int _numIter;
+  multimap<double, VLONG> _sortedLoss;
+  VLONG _numIter;
 
-  vector< pair<double, int> > _sortedAnnualLoss;
-  bool _sortedInAllocatedTVaRSeries;
-  double _meanBase;
-  double _baseWeightedTVaR;
+  /*
+    the index of the queries: the years by decreasing loss (negated loss,
+    iteration ID), the running sums of their losses and the expected loss
+  */
+  mutable vector< pair<double, VLONG> > _sortedAnnualLoss;
+  mutable vector<double> _sortedSums;
+  mutable double _expectedLoss;
+  mutable OnceFlag _index;
 };
 
 }
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+#include "RiskGroup.h"
+
+using namespace std;
+
+namespace VCAPS
+{
+
+// the attributes of an event, the same in every year it occurs in
+struct EventInfo
+{
+  int eventId;
+  int rgId; // RiskGroupTable id
+  const string* riskGroup; // RiskGroupTable name of rgId
+};
+
+/*
+  process wide catalog of the events: each (event ID, risk group) pair
+  is stored once and the VirtualEvents of the years refer to it by its
+  catalog id, instead of every occurrence carrying its own copy of the
+  risk group name. Ids are stable for the life of the process and shared
+  by all simulations. Like RiskGroupTable, intern goes through a
+  per-thread cache first; info() takes no lock: the entries are stored in
+  chunks that never move once allocated.
+  The catalog only grows, by about 100 bytes per distinct (event ID, risk
+  group) pair: a server loading many simulations keeps the pairs of all
+  of them, bounded by the 2^31 - 1 ids. intern returns -1 once they are
+  all handed out, and VirtualYear::addVirtualEvent refuses such an
+  event, so the load fails instead of the process
+*/
+class EventCatalog
+{
+public:
+  static int intern(int eventId, int rgId) {
+    static thread_local unordered_map<long long, int> cache;
+    long long k = key(eventId, rgId);
+    unordered_map<long long, int>::iterator ic = cache.find(k);
+    if (ic != cache.end())
+      return ic->second;
+
+    Registry& r = registry();
+    int id;
+    {
+      lock_guard<mutex> lck(r.mtx);
+      unordered_map<long long, int>::iterator i = r.ids.find(k);
+      if (i != r.ids.end())
+        id = i->second;
+      else {
+        // the ids are ints indexing maxChunks chunks
+        if (r.ids.size() >= (size_t)maxChunks * chunkSize - 1)
+          return -1;
+        id = (int)r.ids.size();
+        EventInfo* chunk = r.chunks[id >> chunkBits].load(memory_order_relaxed);
+        if (!chunk) {
+          chunk = new EventInfo[chunkSize];
+          r.chunks[id >> chunkBits].store(chunk, memory_order_release);
+        }
+        EventInfo& info = chunk[id & (chunkSize - 1)];
+        info.eventId = eventId;
+        info.rgId = rgId;
+        info.riskGroup = &RiskGroupTable::name(rgId);
+        r.ids[k] = id;
+        r.count.store(id + 1, memory_order_release);
+      }
+    }
+    cache[k] = id;
+    return id;
+  }
+
+  static int intern(int eventId, const string& riskGroup) {
+    return intern(eventId, RiskGroupTable::intern(riskGroup));
+  }
+
+  static const EventInfo& info(int id) {
+    return registry().chunks[id >> chunkBits].load(memory_order_acquire)[id & (chunkSize - 1)];
+  }
+
+  // number of ids handed out so far, ids are 0..size()-1
+  static int size() { return registry().count.load(memory_order_acquire); }
+
+private:
+  static const int chunkBits = 16, chunkSize = 1 << chunkBits, maxChunks = 1 << 15;
+
+  static long long key(int eventId, int rgId) {
+    return ((long long)eventId << 32) | (unsigned int)rgId;
+  }
+
+  struct Registry {
+    Registry() : count(0) {
+      for (int c = 0; c < maxChunks; c++)
+        chunks[c].store(0, memory_order_relaxed);
+    }
+    mutex mtx;
+    unordered_map<long long, int> ids;
+    atomic<EventInfo*> chunks[maxChunks];
+    atomic<int> count;
+  };
+
+  static Registry& registry() { static Registry r; return r; }
+};
+
+}
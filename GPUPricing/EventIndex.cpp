@@ -0,0 +1,166 @@
+#include "EventIndex.h"
+
+#include <algorithm>
+#include <omp.h>
+
+#include "Trace.h"
+
+namespace VCAPS
+{
+
+static bool byEventId(const EventIndex::Occurrence& a, const EventIndex::Occurrence& b)
+{
+  return a.eventId < b.eventId;
+}
+
+// stable sort by event ID: the chunks of the threads are sorted, then
+//  merged pairwise, neighbours only, so ties keep their order
+static void sortByEventId(vector<EventIndex::Occurrence>& occurrences)
+{
+  size_t n = occurrences.size();
+  int nChunks = (std::max)(1, (std::min)(omp_get_max_threads(), (int)(n / 4096)));
+  vector<size_t> bounds(nChunks + 1);
+  for (int c = 0; c <= nChunks; c++)
+    bounds[c] = n * c / nChunks;
+
+#pragma omp parallel for schedule(static, 1)
+  for (int c = 0; c < nChunks; c++)
+    stable_sort(occurrences.begin() + bounds[c], occurrences.begin() + bounds[c + 1], byEventId);
+
+  vector<EventIndex::Occurrence> merged(nChunks > 1 ? n : 0);
+  for (size_t width = 1; width < (size_t)nChunks; width *= 2) {
+    long nMerges = (long)((nChunks + 2 * width - 1) / (2 * width));
+#pragma omp parallel for schedule(static, 1)
+    for (long m = 0; m < nMerges; m++) {
+      size_t first = bounds[m * 2 * width];
+      size_t middle = bounds[(std::min)((size_t)nChunks, m * 2 * width + width)];
+      size_t last = bounds[(std::min)((size_t)nChunks, m * 2 * width + 2 * width)];
+      merge(occurrences.begin() + first, occurrences.begin() + middle,
+            occurrences.begin() + middle, occurrences.begin() + last,
+            merged.begin() + first, byEventId);
+    }
+    occurrences.swap(merged);
+  }
+}
+
+EventIndex::EventIndex(const Simulation& sim)
+  : _numIter(sim.get_numIter())
+{
+  TRACE_SCOPE("event index");
+  const VirtualYear::MAP& iterations = sim.getIterations();
+  const ScaleFactors& factors = sim.get_factors();
+
+  vector<const VirtualYear*> years;
+  vector<size_t> offsets;
+  years.reserve(iterations.size());
+  _iterIds.reserve(iterations.size());
+  offsets.reserve(iterations.size() + 1);
+  offsets.push_back(0);
+  for (VirtualYear::ConstIterator iI = iterations.begin(); iI != iterations.end(); iI++) {
+    years.push_back(&iI->second);
+    _iterIds.push_back(iI->first);
+    offsets.push_back(offsets.back() + iI->second.size());
+  }
+
+  long nYears = (long)years.size();
+  _occurrences.resize(offsets.back());
+  _annualLosses[0].assign(nYears, 0.);
+  _annualLosses[1].assign(nYears, 0.);
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (long y = 0; y < nYears; y++) {
+    const VirtualEvent::MAP& events = years[y]->get_events();
+    size_t k = offsets[y];
+    for (VirtualEvent::ConstIterator iE = events.begin(); iE != events.end(); iE++, k++) {
+      const VirtualEvent& e = iE->second;
+      double factor = factors.of(e) * years[y]->factor();
+      Occurrence& o = _occurrences[k];
+      o.iterId = _iterIds[y];
+      o.eventId = e.eventId();
+      o.sequenceId = iE->first;
+      o.loss = e.loss * factor;
+      o.reinstatementPrem = e.reinstatementPrem * factor;
+      _annualLosses[0][y] += o.lossOf(false);
+      _annualLosses[1][y] += o.lossOf(true);
+    }
+  }
+
+  sortByEventId(_occurrences);
+}
+
+EventIndex::RANGE EventIndex::find(int eventId) const
+{
+  Occurrence key;
+  key.eventId = eventId;
+  const Occurrence* begin = _occurrences.empty() ? 0 : &_occurrences[0];
+  return equal_range(begin, begin + _occurrences.size(), key, byEventId);
+}
+
+vector<VLONG> EventIndex::years(int eventId) const
+{
+  vector<VLONG> ids;
+  RANGE r = find(eventId);
+  for (const Occurrence* o = r.first; o != r.second; o++)
+    if (ids.empty() || ids.back() != o->iterId)
+      ids.push_back(o->iterId);
+  return ids;
+}
+
+double EventIndex::totalLoss(int eventId, bool includeReinstatePrem) const
+{
+  double total = 0;
+  RANGE r = find(eventId);
+  for (const Occurrence* o = r.first; o != r.second; o++)
+    total += o->lossOf(includeReinstatePrem);
+  return total;
+}
+
+size_t EventIndex::occurrencesInTop(int eventId, size_t topN, bool includeReinstatePrem) const
+{
+  size_t count = 0;
+  RANGE r = find(eventId);
+  for (const Occurrence* o = r.first; o != r.second; o++)
+    count += _rank(o->iterId, includeReinstatePrem) < topN;
+  return count;
+}
+
+double EventIndex::lossInTop(int eventId, size_t topN, bool includeReinstatePrem) const
+{
+  double total = 0;
+  RANGE r = find(eventId);
+  for (const Occurrence* o = r.first; o != r.second; o++)
+    if (_rank(o->iterId, includeReinstatePrem) < topN)
+      total += o->lossOf(includeReinstatePrem);
+  return total;
+}
+
+size_t EventIndex::_rank(VLONG iterId, bool includeReinstatePrem) const
+{
+  int net = includeReinstatePrem ? 1 : 0;
+  _ranked[net].call([this, includeReinstatePrem]() { _buildRanking(includeReinstatePrem); });
+  size_t y = lower_bound(_iterIds.begin(), _iterIds.end(), iterId) - _iterIds.begin();
+  return _ranks[net][y];
+}
+
+void EventIndex::_buildRanking(bool includeReinstatePrem) const
+{
+  const vector<double>& losses = _annualLosses[includeReinstatePrem ? 1 : 0];
+  vector<size_t> order(losses.size());
+  for (size_t y = 0; y < order.size(); y++)
+    order[y] = y;
+  // the years are in iteration order, so ties go to the smaller ID
+  stable_sort(order.begin(), order.end(),
+              [&losses](size_t a, size_t b) { return losses[a] > losses[b]; });
+
+  // the iterations without events rank after the positive years
+  size_t positive = 0;
+  while (positive < order.size() && losses[order[positive]] > 0)
+    positive++;
+  size_t zeros = _numIter > (VLONG)order.size() ? (size_t)(_numIter - order.size()) : 0;
+
+  vector<size_t>& ranks = _ranks[includeReinstatePrem ? 1 : 0];
+  ranks.resize(order.size());
+  for (size_t r = 0; r < order.size(); r++)
+    ranks[order[r]] = r < positive ? r : r + zeros;
+}
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+
+#include "Simulation.h"
+#include "OnceFlag.h"
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  inverted index of a Simulation: where each event ID occurs, in
+  iteration and sequence order, with the loss of each occurrence, so
+  event attribution does not rescan every year. Built in parallel from
+  the simulation as it is when the index is made, pending scale factors
+  applied; later changes to the simulation are not seen.
+
+  The top-N queries rank the years by annual loss (largest first, then
+  by iteration ID), the ranking being built on first use. The iterations
+  without events count as zero losses, after the positive years and
+  before the negative ones, so the top N years are the tail of
+  AnnualLoss::getTVaR and TailContributionEngine
+*/
+class EventIndex
+{
+public:
+  struct Occurrence
+  {
+    VLONG iterId;
+    int eventId;
+    int sequenceId;
+    double loss, reinstatementPrem;
+
+    double lossOf(bool includeReinstatePrem) const
+    { return includeReinstatePrem ? loss - reinstatementPrem : loss; }
+  };
+  typedef pair<const Occurrence*, const Occurrence*> RANGE;
+
+  EventIndex(const Simulation& sim);
+
+  // number of occurrences of all the events
+  size_t size() const { return _occurrences.size(); }
+
+  // the occurrences of eventId, empty if it does not occur
+  RANGE find(int eventId) const;
+  // the iterations eventId occurs in, ascending
+  vector<VLONG> years(int eventId) const;
+
+  double totalLoss(int eventId, bool includeReinstatePrem=1) const;
+  // occurrences of eventId in the topN years, and their loss
+  size_t occurrencesInTop(int eventId, size_t topN, bool includeReinstatePrem=1) const;
+  double lossInTop(int eventId, size_t topN, bool includeReinstatePrem=1) const;
+
+private:
+  // rank of the year by annual loss among all the iterations, 0 for the
+  //  largest
+  size_t _rank(VLONG iterId, bool includeReinstatePrem) const;
+  void _buildRanking(bool includeReinstatePrem) const;
+
+  // sorted by eventId, then iteration and sequence
+  vector<Occurrence> _occurrences;
+
+  // the years with events and their annual losses, by iteration ID
+  VLONG _numIter;
+  vector<VLONG> _iterIds;
+  vector<double> _annualLosses[2];
+
+  // indexed by includeReinstatePrem, the rank of _iterIds[i]
+  mutable vector<size_t> _ranks[2];
+  mutable OnceFlag _ranked[2];
+};
+
+}
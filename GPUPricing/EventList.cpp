@@ -0,0 +1,204 @@
+#include "EventList.h"
+
+#include <algorithm>
+#include <omp.h>
+
+#include "Log.h"
+
+namespace VCAPS
+{
+
+bool EventList::readFromFile(string simulationFile, double minLossToInclude, string mfid)
+{
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "\t reading simulated events from "
+       << simulationFile << ": >=" << minLossToInclude);
+
+  if (!ToolBox::fileExists(simulationFile)) {
+    cerr << "Error 1: text file " + simulationFile + " not openable " + mfid << endl;
+    return false;
+  }
+  if (!parallelFileReading(simulationFile, minLossToInclude, mfid, 0))
+    return false;
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "-read " << size() << " non-zero events");
+  return true;
+}
+
+void EventList::push_back(VLONG iterId, int seqId, int eventId, double loss,
+                          double reinstatementPrem, int rgId, double fullRip)
+{
+  iterIds.push_back(iterId);
+  seqIds.push_back(seqId);
+  eventIds.push_back(eventId);
+  losses.push_back(loss);
+  reinstatementPrems.push_back(reinstatementPrem);
+  rgIds.push_back(rgId);
+  fullRips.push_back(fullRip);
+}
+
+template<class T>
+static void appendColumn(vector<T>& to, vector<T>& from)
+{
+  if (to.empty())
+    to.swap(from);
+  else
+    to.insert(to.end(), from.begin(), from.end());
+  vector<T>().swap(from);
+}
+
+void EventList::append(EventList& other)
+{
+  if (_numIter == 0)
+    _numIter = other._numIter;
+  appendColumn(iterIds, other.iterIds);
+  appendColumn(seqIds, other.seqIds);
+  appendColumn(eventIds, other.eventIds);
+  appendColumn(rgIds, other.rgIds);
+  appendColumn(losses, other.losses);
+  appendColumn(reinstatementPrems, other.reinstatementPrems);
+  appendColumn(fullRips, other.fullRips);
+  riskGroupMap.insert(other.riskGroupMap.begin(), other.riskGroupMap.end());
+  other.riskGroupMap.clear();
+}
+
+template<class T>
+static void permute(vector<T>& column, const vector<size_t>& order)
+{
+  vector<T> sorted(column.size());
+  long n = (long)order.size();
+#pragma omp parallel for
+  for (long i = 0; i < n; i++)
+    sorted[i] = column[order[i]];
+  column.swap(sorted);
+}
+
+void EventList::sort()
+{
+  size_t n = size();
+  vector<VLONG> keys(n);
+  vector<size_t> order(n);
+  for (size_t k = 0; k < n; k++) {
+    keys[k] = key(k);
+    order[k] = k;
+  }
+  bool sorted = true;
+  for (size_t k = 1; k < n && sorted; k++)
+    sorted = keys[k - 1] <= keys[k];
+  if (sorted)
+    return;
+
+  // ties keep their order, so equal inputs give equal lists
+  stable_sort(order.begin(), order.end(),
+              [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+  permute(iterIds, order);
+  permute(seqIds, order);
+  permute(eventIds, order);
+  permute(rgIds, order);
+  permute(losses, order);
+  permute(reinstatementPrems, order);
+  permute(fullRips, order);
+}
+
+EL_SD EventList::get_expected_sd(bool includeReinstatePrem) const
+{
+  if (_numIter == 0)
+    return EL_SD(0., 0.);
+
+  // the rows of a key are one year, as addVirtualEvent sums them in the
+  //  year store; they are consecutive, the rows being sorted
+  long n = (long)size();
+  vector<double> annualLosses;
+  annualLosses.reserve(n);
+  for (long k = 0; k < n; k++) {
+    double loss = includeReinstatePrem ? losses[k] - reinstatementPrems[k] : losses[k];
+    if (k > 0 && key(k) == key(k - 1))
+      annualLosses.back() += loss;
+    else
+      annualLosses.push_back(loss);
+  }
+
+  // many more keys than iterations: the sums still divide by numIter
+  Moments m = Reduction::moments(annualLosses);
+  m.normalize((double)_numIter);
+  return EL_SD(m.mean, sqrt(m.variance()));
+}
+
+void EventList::aggregateByRiskGroup(map<string, AnnualLoss>& annualLosses,
+                                     bool includeReinstatePrem) const
+{
+  typedef vector< pair<VLONG, double> > ENTRIES; // (key, annual loss)
+
+  long n = (long)size();
+  int nGroups = 0;
+  for (long k = 0; k < n; k++)
+    nGroups = (std::max)(nGroups, rgIds[k] + 1);
+
+  // [chunk][risk group id], each chunk is a contiguous range of rows so
+  //  its entries are in key order. Fixed chunks, not one per thread: the
+  //  team may be smaller than omp_get_max_threads()
+  const long chunkRows = 1 << 16;
+  long nChunks = (n + chunkRows - 1) / chunkRows;
+  vector< vector<ENTRIES> > partial(nChunks, vector<ENTRIES>(nGroups));
+#pragma omp parallel for schedule(dynamic, 1)
+  for (long c = 0; c < nChunks; c++) {
+    vector<ENTRIES>& local = partial[c];
+    long end = (std::min)(n, (c + 1) * chunkRows);
+    for (long k = c * chunkRows; k < end; k++) {
+      ENTRIES& entries = local[rgIds[k]];
+      VLONG yearId = key(k);
+      double loss = includeReinstatePrem ? losses[k] - reinstatementPrems[k] : losses[k];
+      if (entries.empty() || entries.back().first != yearId)
+        entries.push_back(pair<VLONG, double>(yearId, loss));
+      else
+        entries.back().second += loss;
+    }
+  }
+
+  vector<AnnualLoss> byId(nGroups, AnnualLoss(_numIter));
+  vector<char> seen(nGroups, 0);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int g = 0; g < nGroups; g++) {
+    AnnualLoss::MAP& groupLosses = byId[g].get_annualLoss();
+    for (long c = 0; c < nChunks; c++) {
+      ENTRIES& entries = partial[c][g];
+      if (!entries.empty())
+        seen[g] = 1;
+      // the rows of a key may straddle two chunks
+      for (size_t i = 0; i < entries.size(); i++)
+        groupLosses[entries[i].first] += entries[i].second;
+      ENTRIES().swap(entries);
+    }
+  }
+
+  annualLosses.clear();
+  for (int g = 0; g < nGroups; g++)
+    if (seen[g])
+      annualLosses[RiskGroupTable::name(g)].swap(byId[g]);
+}
+
+void EventList::get_expected_sd(map<string, EL_SD>& elsd, bool includeReinstatePrem) const
+{
+  map<string, AnnualLoss> annualLosses;
+  aggregateByRiskGroup(annualLosses, includeReinstatePrem);
+  elsd.clear();
+  for (map<string, AnnualLoss>::iterator i = annualLosses.begin(); i != annualLosses.end(); i++)
+    elsd[i->first] = i->second.get_expected_sd();
+}
+
+Simulation EventList::toSimulation() const
+{
+  Simulation sim(_numIter);
+  VirtualYear::MAP iterations;
+  for (size_t k = 0; k < size(); k++) {
+    VLONG yearId = key(k);
+    VirtualYear& year = iterations.insert(iterations.end(),
+                          VirtualYear::Pair(yearId, VirtualYear()))->second;
+    year.iterId = yearId;
+    year.addVirtualEvent(seqIds[k], VirtualEvent::cataloged(EventCatalog::intern(eventIds[k], rgIds[k]),
+                           losses[k], reinstatementPrems[k], fullRips[k]), 1.0, yearId, true);
+  }
+  sim = iterations;
+  sim.riskGroupMap = riskGroupMap;
+  return sim;
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Simulation.h"
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  the events of a simulation read ignoring the ordering, i.e. each event
+  is a year of its own: one flat row per event with its original
+  iteration ID, instead of one VirtualYear (and its maps) per event.
+  The rows are sorted by key(), the year ID the event gets in a
+  Simulation read with ignoreOrdering; the rows of a key, e.g. the risk
+  groups of one event, make one year as they do there, so the aggregates
+  below give the same results as the Simulation ones. rgIds are
+  RiskGroupTable ids
+*/
+class EventList
+{
+public:
+  EventList() : _numIter(0) {}
+
+  // same file format, arguments and errors as Simulation's; the loader
+  //  threads are Simulation's, in Simulation.cpp
+  bool parallelFileReading(string filename, double minLossToInclude, string mfid,
+                           double fullRipScale);
+  bool readFromFile(string simulationFileName, double minLossToInclude, string mfid);
+
+  VLONG get_numIter() const { return _numIter; }
+  void set_numIter(VLONG numIter) { _numIter = numIter; }
+  size_t size() const { return losses.size(); }
+  bool empty() const { return losses.empty(); }
+
+  // the iteration in the high 31 bits and the sequence in the low 32
+  static VLONG key(VLONG iterId, int seqId) { return ((iterId + 1) << 32) | (unsigned int)seqId; }
+  VLONG key(size_t k) const { return key(iterIds[k], seqIds[k]); }
+
+  void push_back(VLONG iterId, int seqId, int eventId, double loss,
+                 double reinstatementPrem, int rgId, double fullRip);
+  // appends other's rows, then sort() restores the order
+  void append(EventList& other);
+  void sort();
+
+  EL_SD get_expected_sd(bool includeReinstatePrem=1) const;
+  // key = risk group name, the annual losses keyed by key()
+  void aggregateByRiskGroup(map<string, AnnualLoss>& annualLosses,
+                            bool includeReinstatePrem=1) const;
+  void get_expected_sd(map<string, EL_SD>& elsd, bool includeReinstatePrem=1) const;
+
+  // one year per event, for the code that needs a Simulation
+  Simulation toSimulation() const;
+
+  vector<VLONG> iterIds;
+  vector<int> seqIds;
+  vector<int> eventIds;
+  vector<int> rgIds;
+  vector<double> losses;
+  vector<double> reinstatementPrems;
+  vector<double> fullRips;
+  Simulation::RGMAP riskGroupMap;
+
+private:
+  VLONG _numIter;
+};
+
+}
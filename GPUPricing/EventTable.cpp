@@ -0,0 +1,334 @@
+#include "EventTable.h"
+
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+namespace VCAPS
+{
+
+EventTable::EventTable()
+  : _numIter(0)
+{
+  vector<size_t> offsets(1, 0);
+  yearOffsets.assign(offsets);
+}
+
+EventTable::EventTable(const Simulation& sim)
+  : _numIter(sim.get_numIter())
+{
+  const VirtualYear::MAP& iterations = sim.getIterations();
+  const ScaleFactors& factors = sim.get_factors();
+
+  vector<const VirtualYear*> years;
+  vector<VLONG> ids;
+  vector<size_t> offsets;
+  years.reserve(iterations.size());
+  ids.reserve(iterations.size());
+  offsets.reserve(iterations.size() + 1);
+  offsets.push_back(0);
+  for (VirtualYear::ConstIterator iI = iterations.begin(); iI != iterations.end(); iI++) {
+    years.push_back(&iI->second);
+    ids.push_back(iI->first);
+    offsets.push_back(offsets.back() + iI->second.size());
+  }
+
+  size_t n = offsets.back();
+  vector<int> seqs(n), events(n), rgs(n);
+  vector<double> loss(n), rip(n), fullRip(n);
+  long nYears = (long)years.size();
+  int nGlobal = RiskGroupTable::size();
+  vector<char> used(nGlobal, 0);
+#pragma omp parallel
+  {
+    vector<char> threadUsed(nGlobal, 0);
+#pragma omp for schedule(dynamic, 1024)
+    for (long y = 0; y < nYears; y++) {
+      double yearFactor = years[y]->factor();
+      size_t k = offsets[y];
+      const VirtualEvent::MAP& yearEvents = years[y]->get_events();
+      for (VirtualEvent::ConstIterator iE = yearEvents.begin(); iE != yearEvents.end(); iE++, k++) {
+        const VirtualEvent& e = iE->second;
+        double factor = yearFactor * factors.of(e);
+        seqs[k] = iE->first;
+        events[k] = e.eventId();
+        rgs[k] = e.rgId();
+        loss[k] = e.loss * factor;
+        rip[k] = e.reinstatementPrem * factor;
+        fullRip[k] = e.fullRip * factor;
+        threadUsed[e.rgId()] = 1;
+      }
+    }
+#pragma omp critical
+    for (int id = 0; id < nGlobal; id++)
+      used[id] |= threadUsed[id];
+  }
+
+  // the risk groups present, in RiskGroupTable order
+  vector<int> localId(nGlobal, -1);
+  for (int id = 0; id < nGlobal; id++) {
+    if (used[id]) {
+      localId[id] = (int)riskGroups.size();
+      riskGroups.push_back(RiskGroupTable::name(id));
+    }
+  }
+  long nEvents = (long)n;
+#pragma omp parallel for
+  for (long k = 0; k < nEvents; k++)
+    rgs[k] = localId[rgs[k]];
+
+  yearIds.assign(ids);
+  yearOffsets.assign(offsets);
+  seqIds.assign(seqs);
+  eventIds.assign(events);
+  rgIds.assign(rgs);
+  losses.assign(loss);
+  reinstatementPrems.assign(rip);
+  fullRips.assign(fullRip);
+}
+
+Simulation EventTable::toSimulation() const
+{
+  Simulation sim(_numIter);
+  vector<int> globalIds(riskGroups.size());
+  for (size_t r = 0; r < riskGroups.size(); r++)
+    globalIds[r] = RiskGroupTable::intern(riskGroups[r]);
+  VirtualYear::MAP iterations;
+  for (size_t y = 0; y < numYears(); y++) {
+    VirtualYear& year = iterations.insert(iterations.end(),
+                          VirtualYear::Pair(yearIds[y], VirtualYear()))->second;
+    year.iterId = yearIds[y];
+    for (size_t k = yearOffsets[y]; k < yearOffsets[y + 1]; k++)
+      year.addVirtualEvent(seqIds[k], VirtualEvent::cataloged(EventCatalog::intern(eventIds[k], globalIds[rgIds[k]]),
+                             losses[k], reinstatementPrems[k], fullRips[k]), 1.0, yearIds[y], true);
+  }
+  sim = iterations;
+  for (size_t r = 0; r < riskGroups.size(); r++)
+    sim.riskGroupMap[riskGroups[r]] = 1;
+  return sim;
+}
+
+/*
+  layout of a published or saved table: the header, then the columns in
+  the order of the header offsets, each aligned on a cache line; the risk
+  group names are stored '\0' terminated one after the other. The magic
+  is written last so a table being published is not attached
+*/
+static const char segmentMagic[8] = { 'V', 'C', 'A', 'P', 'S', 'E', 'T', '2' };
+
+struct SegmentHeader
+{
+  char magic[8];
+  int64_t numIter;
+  int32_t numRiskGroups;
+  int32_t reserved;
+  uint64_t numYears, numEvents;
+  uint64_t yearIds, yearOffsets, seqIds, eventIds, rgIds;
+  uint64_t losses, reinstatementPrems, fullRips;
+  uint64_t riskGroups, riskGroupsSize;
+  uint64_t size;
+};
+
+static string segmentName(const string& name)
+{
+  return name.size() > 0 && name[0] == '/' ? name : "/" + name;
+}
+
+static uint64_t place(uint64_t& size, uint64_t bytes)
+{
+  uint64_t offset = (size + 63) & ~(uint64_t)63;
+  size = offset + bytes;
+  return offset;
+}
+
+bool EventTable::_writeImage(int fd, const string& what) const
+{
+  SegmentHeader h;
+  memset(&h, 0, sizeof(h));
+  h.numIter = _numIter;
+  h.numRiskGroups = (int32_t)riskGroups.size();
+  h.numYears = numYears();
+  h.numEvents = numEvents();
+  string names;
+  for (size_t r = 0; r < riskGroups.size(); r++)
+    names.append(riskGroups[r].c_str(), riskGroups[r].size() + 1);
+
+  uint64_t size = sizeof(h);
+  h.yearIds = place(size, h.numYears * sizeof(VLONG));
+  h.yearOffsets = place(size, (h.numYears + 1) * sizeof(uint64_t));
+  h.seqIds = place(size, h.numEvents * sizeof(int32_t));
+  h.eventIds = place(size, h.numEvents * sizeof(int32_t));
+  h.rgIds = place(size, h.numEvents * sizeof(int32_t));
+  h.losses = place(size, h.numEvents * sizeof(double));
+  h.reinstatementPrems = place(size, h.numEvents * sizeof(double));
+  h.fullRips = place(size, h.numEvents * sizeof(double));
+  h.riskGroups = place(size, names.size());
+  h.riskGroupsSize = names.size();
+  h.size = size;
+
+  if (ftruncate(fd, size) < 0) {
+    cerr << "Error: can not size " << what << ": " << strerror(errno) << endl;
+    return false;
+  }
+  char* base = (char*)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    cerr << "Error: can not map " << what << ": " << strerror(errno) << endl;
+    return false;
+  }
+
+  memcpy(base + h.yearIds, yearIds.data(), h.numYears * sizeof(VLONG));
+  memcpy(base + h.yearOffsets, yearOffsets.data(), (h.numYears + 1) * sizeof(uint64_t));
+  memcpy(base + h.seqIds, seqIds.data(), h.numEvents * sizeof(int32_t));
+  memcpy(base + h.eventIds, eventIds.data(), h.numEvents * sizeof(int32_t));
+  memcpy(base + h.rgIds, rgIds.data(), h.numEvents * sizeof(int32_t));
+  memcpy(base + h.losses, losses.data(), h.numEvents * sizeof(double));
+  memcpy(base + h.reinstatementPrems, reinstatementPrems.data(), h.numEvents * sizeof(double));
+  memcpy(base + h.fullRips, fullRips.data(), h.numEvents * sizeof(double));
+  memcpy(base + h.riskGroups, names.data(), names.size());
+  memcpy(base, &h, sizeof(h));
+  __sync_synchronize();
+  memcpy(base, segmentMagic, sizeof(segmentMagic));
+  munmap(base, size);
+  return true;
+}
+
+// count elements of T at offset lie within an image of size bytes
+template<class T>
+static bool fits(uint64_t offset, uint64_t count, uint64_t size)
+{
+  return offset % sizeof(T) == 0 && offset <= size && count <= (size - offset) / sizeof(T);
+}
+
+/*
+  the header of an image of size bytes describes columns and risk group
+  names that lie within it, so a truncated or corrupt file or segment is
+  rejected instead of read out of bounds. The contents are not scanned,
+  attach stays O(1), but the year offsets must span the events
+*/
+static bool validImage(const char* p, uint64_t size, vector<string>& riskGroups)
+{
+  const SegmentHeader& h = *(const SegmentHeader*)p;
+  if (memcmp(h.magic, segmentMagic, sizeof(segmentMagic)) != 0 || h.size != size)
+    return false;
+  if (h.numRiskGroups < 0 || h.numYears >= size || h.numEvents >= size)
+    return false;
+  if (!fits<VLONG>(h.yearIds, h.numYears, size) || !fits<uint64_t>(h.yearOffsets, h.numYears + 1, size)
+      || !fits<int32_t>(h.seqIds, h.numEvents, size) || !fits<int32_t>(h.eventIds, h.numEvents, size)
+      || !fits<int32_t>(h.rgIds, h.numEvents, size) || !fits<double>(h.losses, h.numEvents, size)
+      || !fits<double>(h.reinstatementPrems, h.numEvents, size)
+      || !fits<double>(h.fullRips, h.numEvents, size) || !fits<char>(h.riskGroups, h.riskGroupsSize, size))
+    return false;
+  const uint64_t* offsets = (const uint64_t*)(p + h.yearOffsets);
+  if (offsets[0] != 0 || offsets[h.numYears] != h.numEvents)
+    return false;
+
+  riskGroups.clear();
+  const char* rg = p + h.riskGroups;
+  const char* end = rg + h.riskGroupsSize;
+  while ((int)riskGroups.size() < h.numRiskGroups) {
+    const char* nul = (const char*)memchr(rg, '\0', end - rg);
+    if (!nul)
+      return false;
+    riskGroups.push_back(string(rg, nul));
+    rg = nul + 1;
+  }
+  return true;
+}
+
+bool EventTable::_mapImage(int fd, EventTable& table)
+{
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SegmentHeader))
+    return false;
+  size_t size = st.st_size;
+  void* base = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    return false;
+
+  const char* p = (const char*)base;
+  vector<string> riskGroups;
+  if (!validImage(p, size, riskGroups)) {
+    munmap(base, size);
+    return false;
+  }
+
+  const SegmentHeader& h = *(const SegmentHeader*)base;
+  table = EventTable();
+  table._segment = shared_ptr<const void>(base, [size](const void* b) { munmap((void*)b, size); });
+  table._numIter = h.numIter;
+  table.yearIds.borrow((const VLONG*)(p + h.yearIds), h.numYears);
+  table.yearOffsets.borrow((const size_t*)(p + h.yearOffsets), h.numYears + 1);
+  table.seqIds.borrow((const int*)(p + h.seqIds), h.numEvents);
+  table.eventIds.borrow((const int*)(p + h.eventIds), h.numEvents);
+  table.rgIds.borrow((const int*)(p + h.rgIds), h.numEvents);
+  table.losses.borrow((const double*)(p + h.losses), h.numEvents);
+  table.reinstatementPrems.borrow((const double*)(p + h.reinstatementPrems), h.numEvents);
+  table.fullRips.borrow((const double*)(p + h.fullRips), h.numEvents);
+  table.riskGroups.swap(riskGroups);
+  return true;
+}
+
+bool EventTable::publish(const string& name) const
+{
+  string shmName = segmentName(name);
+  int fd = shm_open(shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    cerr << "Error: can not create shared memory " << shmName << ": " << strerror(errno) << endl;
+    return false;
+  }
+  bool written = _writeImage(fd, "shared memory " + shmName);
+  close(fd);
+  if (!written)
+    shm_unlink(shmName.c_str());
+  return written;
+}
+
+bool EventTable::attach(const string& name, EventTable& table)
+{
+  int fd = shm_open(segmentName(name).c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+  bool mapped = _mapImage(fd, table);
+  close(fd);
+  return mapped;
+}
+
+bool EventTable::save(const string& fileName) const
+{
+  int fd = open(fileName.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+  if (fd < 0) {
+    cerr << "Error: can not create " << fileName << ": " << strerror(errno) << endl;
+    return false;
+  }
+  bool written = _writeImage(fd, fileName);
+  close(fd);
+  return written;
+}
+
+bool EventTable::load(const string& fileName, EventTable& table)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  bool mapped = _mapImage(fd, table);
+  close(fd);
+  return mapped;
+}
+
+bool EventTable::isPublished(const string& name)
+{
+  EventTable table;
+  return attach(name, table);
+}
+
+void EventTable::unpublish(const string& name)
+{
+  shm_unlink(segmentName(name).c_str());
+}
+
+}
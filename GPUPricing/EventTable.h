@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "Simulation.h"
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  read-only array of a column of an EventTable: either owned, or borrowed
+  from a shared memory segment the table keeps mapped
+*/
+template<class T>
+class Column
+{
+public:
+  Column() : _data(0), _size(0) {}
+  Column(const Column& other) { *this = other; }
+
+  Column& operator=(const Column& other) {
+    _owned = other._owned;
+    _size = other._size;
+    _data = other._owned.empty() ? other._data : _ownedData();
+    return *this;
+  }
+
+  void assign(vector<T>& values) {
+    _owned.swap(values);
+    _size = _owned.size();
+    _data = _ownedData();
+  }
+  void borrow(const T* data, size_t size) {
+    vector<T>().swap(_owned);
+    _data = data;
+    _size = size;
+  }
+
+  const T& operator[](size_t i) const { return _data[i]; }
+  const T* data() const { return _data; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  const T& back() const { return _data[_size - 1]; }
+
+private:
+  const T* _ownedData() const { return _owned.empty() ? 0 : &_owned[0]; }
+
+  vector<T> _owned;
+  const T* _data;
+  size_t _size;
+};
+
+/*
+  columnar copy of a Simulation: the events of all years laid out in
+  iteration and sequence order in contiguous arrays, so kernels over the
+  losses run as plain (vectorizable) loops. Year y owns the events
+  [yearOffsets[y], yearOffsets[y+1]). Pending scale factors are applied
+  when the table is built; rgIds index riskGroups, not the process wide
+  RiskGroupTable, so the table means the same in every process.
+
+  A table can be published in a named POSIX shared memory segment and
+  attached read-only by other processes on the host, without parsing or
+  copying the events: the segment is a header followed by the columns at
+  offsets from its start, so it maps anywhere. The same image saved to a
+  file is the segment format of SegmentedSimulation
+*/
+class EventTable
+{
+public:
+  EventTable();
+  EventTable(const Simulation& sim);
+
+  VLONG get_numIter() const { return _numIter; }
+  size_t numYears() const { return yearIds.size(); }
+  size_t numEvents() const { return losses.size(); }
+
+  // the events back in a Simulation, for the code that needs one
+  Simulation toSimulation() const;
+
+  // false, and why on cerr, if the segment can not be created (it exists
+  //  already for instance: remove it first)
+  bool publish(const string& name) const;
+  // false if there is no complete table published under name
+  static bool attach(const string& name, EventTable& table);
+  static bool isPublished(const string& name);
+  static void unpublish(const string& name);
+
+  // the image in a file, mapped read-only (and paged in on use) by load
+  bool save(const string& fileName) const;
+  static bool load(const string& fileName, EventTable& table);
+
+  Column<VLONG> yearIds;
+  Column<size_t> yearOffsets;
+  Column<int> seqIds;
+  Column<int> eventIds;
+  Column<int> rgIds;
+  Column<double> losses;
+  Column<double> reinstatementPrems;
+  Column<double> fullRips;
+  vector<string> riskGroups;
+
+private:
+  bool _writeImage(int fd, const string& what) const;
+  static bool _mapImage(int fd, EventTable& table);
+
+  VLONG _numIter;
+  // the mapped segment of an attached table
+  shared_ptr<const void> _segment;
+};
+
+}
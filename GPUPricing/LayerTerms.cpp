@@ -0,0 +1,91 @@
+#include "LayerTerms.h"
+
+#include <algorithm>
+#include <omp.h>
+
+#include "Trace.h"
+
+namespace VCAPS
+{
+
+LayerTermsEngine::LayerTermsEngine(const Simulation& sim)
+  : _table(sim)
+{
+  _init();
+}
+
+LayerTermsEngine::LayerTermsEngine(const EventTable& table)
+  : _table(table)
+{
+  _init();
+}
+
+void LayerTermsEngine::_init()
+{
+  const Column<size_t>& offsets = _table.yearOffsets;
+  size_t nYears = _table.numYears();
+  _blockYears.push_back(0);
+  for (size_t y = 0; y < nYears; ) {
+    size_t begin = y;
+    while (y < nYears && (y == begin || offsets[y + 1] - offsets[begin] <= blockSize))
+      y++;
+    _blockYears.push_back(y);
+  }
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void LayerTermsEngine::occurrenceTerms(const double* in, double* out, size_t n,
+                                       double retention, double limit)
+{
+  for (size_t i = 0; i < n; i++)
+    out[i] = (std::min)((std::max)(in[i] - retention, 0.0), limit);
+}
+
+void LayerTermsEngine::_applyLayer(const Layer& layer, vector<double>& buffer, 
+                                   AnnualLoss& result) const
+{
+  const Column<size_t>& offsets = _table.yearOffsets;
+  AnnualLoss::MAP& annualLoss = result.get_annualLoss();
+  result.set_numIter(_table.get_numIter());
+
+  for (size_t b = 0; b + 1 < _blockYears.size(); b++) {
+    size_t firstYear = _blockYears[b], endYear = _blockYears[b + 1];
+    size_t first = offsets[firstYear], n = offsets[endYear] - first;
+    if (buffer.size() < n)
+      buffer.resize(n);
+    occurrenceTerms(&_table.losses[first], &buffer[0], n, layer.occRetention, layer.occLimit);
+
+    for (size_t y = firstYear; y < endYear; y++) {
+      double ceded = 0;
+      for (size_t k = offsets[y] - first; k < offsets[y + 1] - first; k++)
+        ceded += buffer[k];
+      double x = layer.annualTerms(ceded);
+      if (x != 0)
+        annualLoss[_table.yearIds[y]] = x;
+    }
+  }
+}
+
+AnnualLoss LayerTermsEngine::apply(const Layer& layer) const
+{
+  vector<double> buffer(blockSize);
+  AnnualLoss result;
+  _applyLayer(layer, buffer, result);
+  return result;
+}
+
+void LayerTermsEngine::apply(const vector<Layer>& layers, vector<AnnualLoss>& annualLosses) const
+{
+  long nLayers = (long)layers.size();
+  annualLosses.assign(nLayers, AnnualLoss());
+#pragma omp parallel
+  {
+    TRACE_SCOPE("layer terms");
+    vector<double> buffer(blockSize);
+#pragma omp for schedule(dynamic, 1)
+    for (long l = 0; l < nLayers; l++)
+      _applyLayer(layers[l], buffer, annualLosses[l]);
+  }
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <limits>
+
+#include "EventTable.h"
+#include "AnnualLoss.h"
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  excess of loss terms: each event is ceded 
+    min(max(loss - occRetention, 0), occLimit)
+  and each year 
+    share * min(max(sum of ceded - aggDeductible, 0), aggLimit)
+  The reinstatement terms (premium for 100% of the layer and one rate per
+  reinstatement) are only used by the ReinstatementEngine
+*/
+struct Layer
+{
+  string name;
+  double occRetention, occLimit;
+  double aggDeductible, aggLimit;
+  double share;
+  double premium;
+  vector<double> reinstatementRates;
+
+  Layer()
+    : occRetention(0), occLimit(numeric_limits<double>::infinity()),
+      aggDeductible(0), aggLimit(numeric_limits<double>::infinity()), share(1),
+      premium(0)
+  {}
+
+  double annualTerms(double cededLoss) const {
+    return share * (std::min)((std::max)(cededLoss - aggDeductible, 0.0), aggLimit);
+  }
+};
+
+/*
+  prices a batch of layers against one simulation: the simulation is
+  flattened once into an EventTable, then each layer is one pass over
+  the contiguous losses, layers being spread over the threads
+*/
+class LayerTermsEngine
+{
+public:
+  LayerTermsEngine(const Simulation& sim);
+  // a table attached from shared memory is used in place
+  LayerTermsEngine(const EventTable& table);
+
+  // one AnnualLoss of ceded losses per layer, in the order of layers
+  void apply(const vector<Layer>& layers, vector<AnnualLoss>& annualLosses) const;
+  AnnualLoss apply(const Layer& layer) const;
+
+  const EventTable& get_table() const { return _table; }
+
+  // out[i] = min(max(in[i] - retention, 0), limit), dispatched at run time
+  //  to the widest vector unit of the host
+  static void occurrenceTerms(const double* in, double* out, size_t n,
+                              double retention, double limit);
+
+  // events per block: the ceded losses of a block stay in L1/L2
+  static const size_t blockSize = 8192;
+
+private:
+  void _init();
+  void _applyLayer(const Layer& layer, vector<double>& buffer, AnnualLoss& result) const;
+
+  EventTable _table;
+  // first year of each block of about blockSize events, plus the end
+  vector<size_t> _blockYears;
+};
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <sys/resource.h>
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  what the last simulation file load spent its time on, to tell an I/O
+  bound load (io, and wait in the threads) from a parse bound or an
+  allocator bound (insert) one. The counters are cheap: I/O and wait are
+  timed at block refills only, which one thread does for all, so I/O is
+  only reported for the whole load. A thread's clock is read around the
+  inserts of the kept rows: parse is the time between them less the
+  refills and waits, so it covers the line splitting, number parsing
+  and filtering of the rows
+*/
+struct LoadMetrics
+{
+  struct Thread
+  {
+    long rowsParsed, rowsKept;
+    double waitMs, parseMs, insertMs;
+
+    Thread() : rowsParsed(0), rowsKept(0), waitMs(0), parseMs(0), insertMs(0) {}
+  };
+
+  string file;
+  size_t bytesRead;
+  double ioMs, readMs, mergeMs;
+  long peakRssKB;
+  vector<Thread> threads;
+
+  LoadMetrics() : bytesRead(0), ioMs(0), readMs(0), mergeMs(0), peakRssKB(0) {}
+
+  // the high water mark of the process so far
+  static long peakRss() {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+  }
+
+  // the metrics of the last load in the process
+  static LoadMetrics& last() { static LoadMetrics metrics; return metrics; }
+  // where the loads report their metrics at LOG_INFO, cerr by default so
+  //  they do not mix with results on cout
+  static ostream*& sink() { static ostream* out = &cerr; return out; }
+
+  string json() const {
+    stringstream ss;
+    long parsed = 0, kept = 0;
+    for (size_t t = 0; t < threads.size(); t++) {
+      parsed += threads[t].rowsParsed;
+      kept += threads[t].rowsKept;
+    }
+    ss << "{\"file\": \"";
+    for (size_t i = 0; i < file.size(); i++)
+      ss << (file[i] == '"' || file[i] == '\\' ? "\\" : "") << file[i];
+    ss << "\", \"bytesRead\": " << bytesRead
+       << ", \"rowsParsed\": " << parsed << ", \"rowsFiltered\": " << parsed - kept
+       << ", \"ioMs\": " << ioMs << ", \"readMs\": " << readMs << ", \"mergeMs\": " << mergeMs
+       << ", \"peakRssKB\": " << peakRssKB << ", \"threads\": [";
+    for (size_t t = 0; t < threads.size(); t++) {
+      const Thread& m = threads[t];
+      ss << (t ? ", " : "") << "{\"rowsParsed\": " << m.rowsParsed
+         << ", \"rowsFiltered\": " << m.rowsParsed - m.rowsKept
+         << ", \"waitMs\": " << m.waitMs << ", \"parseMs\": " << m.parseMs
+         << ", \"insertMs\": " << m.insertMs << "}";
+    }
+    ss << "]}";
+    return ss.str();
+  }
+};
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+namespace VCAPS
+{
+
+enum LogLevel { LOG_ERROR = 0, LOG_WARN = 1, LOG_INFO = 2, LOG_DEBUG = 3 };
+
+/*
+  the highest level compiled in: VCAPS_LOG calls above it are removed by
+  the compiler, arguments included. Release builds (NDEBUG) keep up to
+  LOG_INFO, -DVCAPS_LOG_LEVEL=<n> overrides it
+*/
+#ifndef VCAPS_LOG_LEVEL
+#ifdef NDEBUG
+#define VCAPS_LOG_LEVEL 2
+#else
+#define VCAPS_LOG_LEVEL 3
+#endif
+#endif
+
+/*
+  leveled messages: errors and warnings to cerr, the rest to cout (or
+  to cerr too once allToStderr() is called, when cout carries results),
+  one whole line at a time so the lines of threads do not interleave.
+  The level printed is set at run time (LOG_INFO by default) within the
+  compiled in ones
+*/
+class Log
+{
+public:
+  static void setLevel(LogLevel level) { _level().store(level, memory_order_relaxed); }
+  static LogLevel level() { return (LogLevel)_level().load(memory_order_relaxed); }
+  static bool enabled(LogLevel level) { return level <= VCAPS_LOG_LEVEL && level <= Log::level(); }
+  static void allToStderr() { _allToStderr().store(true, memory_order_relaxed); }
+
+  static void write(LogLevel level, const string& line) {
+    write(level <= LOG_WARN || _allToStderr().load(memory_order_relaxed) ? cerr : cout, line);
+  }
+  // to a stream of the caller's, for reports kept apart from the results
+  static void write(ostream& out, const string& line) {
+    lock_guard<mutex> lck(_mutex());
+    out << line << endl;
+  }
+
+private:
+  static mutex& _mutex() { static mutex mtx; return mtx; }
+  static atomic<int>& _level() { static atomic<int> level(LOG_INFO); return level; }
+  static atomic<bool>& _allToStderr() { static atomic<bool> all(false); return all; }
+};
+
+/*
+  VCAPS_LOG(LOG_DEBUG, "read " << countNumEvents() << " events"): the
+  message is only built, and its operands only evaluated, if the level
+  is printed
+*/
+#define VCAPS_LOG(level, message) \
+  do { \
+    if (VCAPS::Log::enabled(level)) { \
+      std::ostringstream _logLine; \
+      _logLine << message; \
+      VCAPS::Log::write(level, _logLine.str()); \
+    } \
+  } while (0)
+
+}
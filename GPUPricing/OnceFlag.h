@@ -0,0 +1,45 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  std::once_flag for the lazily built indexes of copyable classes: a copy
+  starts not yet run, and reset() re-arms it after the owner is modified.
+  reset() must not race with call(). done() tells if the index is built,
+  for owners that keep it up to date, and set() marks it built (on a copy
+  of a built index for instance)
+*/
+class OnceFlag
+{
+public:
+  OnceFlag() : _flag(new once_flag), _done(false) {}
+  OnceFlag(const OnceFlag&) : _flag(new once_flag), _done(false) {}
+  OnceFlag& operator=(const OnceFlag&) { reset(); return *this; }
+
+  // cheap if the flag was not used since the last reset
+  void reset() {
+    if (done()) {
+      _flag.reset(new once_flag);
+      _done.store(false, memory_order_relaxed);
+    }
+  }
+
+  template<class F>
+  void call(F f) { call_once(*_flag, [&]() { f(); _done.store(true, memory_order_release); }); }
+
+  bool done() const { return _done.load(memory_order_acquire); }
+  void set() { call([]() {}); }
+
+private:
+  unique_ptr<once_flag> _flag;
+  atomic<bool> _done;
+};
+
+}
@@ -0,0 +1,339 @@
+#include "PricingServer.h"
+#include "Trace.h"
+#include "Log.h"
+
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace chrono;
+
+// the write end of the wake pipe of the running server: a stop signal
+//  wakes its poll through it, so a signal arriving between two polls is
+//  not lost (self-pipe)
+static volatile sig_atomic_t stopPipe = -1;
+
+static void onStopSignal(int)
+{
+  int saved = errno;
+  if (stopPipe >= 0 && write(stopPipe, "s", 1) < 0) {}
+  errno = saved;
+}
+
+PricingServer::PricingServer(Pricing& pricing, string socketPath, int numThreads)
+  : _pricing(pricing), _socketPath(socketPath), _numThreads(numThreads), _listenFd(-1),
+    _stopping(false)
+{
+  // run() fails without it
+  if (pipe2(_wakePipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+    VCAPS_LOG(LOG_ERROR, "Error: can not create the wake pipe: " << strerror(errno));
+    _wakePipe[0] = _wakePipe[1] = -1;
+  }
+}
+
+PricingServer::~PricingServer()
+{
+  if (_listenFd >= 0)
+    close(_listenFd);
+  if (_wakePipe[0] >= 0) {
+    close(_wakePipe[0]);
+    close(_wakePipe[1]);
+  }
+}
+
+static bool readFully(int fd, char* p, size_t n)
+{
+  while (n > 0) {
+    ssize_t r = read(fd, p, n);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    p += r; n -= r;
+  }
+  return true;
+}
+
+static bool writeFully(int fd, const char* p, size_t n)
+{
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return false;
+    p += w; n -= w;
+  }
+  return true;
+}
+
+bool PricingServer::readFrame(int fd, string& payload, string& error)
+{
+  error.clear();
+  uint32_t size;
+  if (!readFully(fd, (char*)&size, sizeof(size)))
+    return false;
+  size = ntohl(size);
+  if (size > maxFrameSize) {
+    stringstream ss;
+    ss << "frame of " << size << " bytes above the limit of " << maxFrameSize;
+    error = ss.str();
+    return false;
+  }
+  payload.resize(size);
+  if (size == 0 || readFully(fd, &payload[0], size))
+    return true;
+  error = "connection closed in a frame";
+  return false;
+}
+
+bool PricingServer::readFrame(int fd, string& payload)
+{
+  string error;
+  return readFrame(fd, payload, error);
+}
+
+bool PricingServer::writeFrame(int fd, const string& payload)
+{
+  uint32_t size = htonl((uint32_t)payload.size());
+  return writeFully(fd, (const char*)&size, sizeof(size))
+    && writeFully(fd, payload.data(), payload.size());
+}
+
+string PricingServer::handleRequest(const string& request)
+{
+  TRACE_SCOPE("request");
+  vector<Contract> contracts;
+  vector<double> probs;
+  stringstream in(request);
+  string line, error;
+  int lineNo = 0;
+  while (getline(in, line)) {
+    lineNo++;
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.erase(line.size() - 1);
+    if (line.empty() || line[0] == '#')
+      continue;
+    if (line.compare(0, 5, "tvar\t") == 0) {
+      stringstream ss(line.substr(5));
+      string prob;
+      while (getline(ss, prob, ','))
+        probs.push_back(atof(prob.c_str()));
+      continue;
+    }
+    Contract c;
+    if (!Pricing::parseContract(line, c, error)) {
+      stringstream ss;
+      ss << "error\tline " << lineNo << ": " << error << "\n";
+      return ss.str();
+    }
+    // fails fast, before waiting for the loads of other requests
+    string missing = _pricing.missingFile(c.simulationFiles);
+    if (!missing.empty())
+      return "error\t" + missing + " not openable\n";
+    contracts.push_back(c);
+  }
+
+  vector<ContractResult> results;
+  if (!_pricing.priceContracts(contracts, probs, results, error))
+    return "error\t" + error + "\n";
+  stringstream out;
+  out << "ok\n";
+  Pricing::writeResults(contracts, probs, results, out);
+  return out.str();
+}
+
+bool PricingServer::_serve(int fd)
+{
+  string request, error;
+  if (!readFrame(fd, request, error)) {
+    // the rest of an oversize frame is not read, the connection can not
+    //  go on after the reply
+    if (!error.empty()) {
+      VCAPS_LOG(LOG_WARN, "Warning: " << error << ", connection closed");
+      writeFrame(fd, "error\t" + error + "\n");
+    }
+    return false;
+  }
+  if (request.empty())
+    return false;
+  high_resolution_clock::time_point _start = high_resolution_clock::now();
+  if (!writeFrame(fd, handleRequest(request)))
+    return false;
+  milliseconds ms = duration_cast<milliseconds>(high_resolution_clock::now() - _start);
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "\t request of " << request.size()
+       << " bytes priced in " << ms.count() << " ms");
+  return true;
+}
+
+void PricingServer::_worker()
+{
+  while (true) {
+    int fd;
+    {
+      unique_lock<mutex> lock(_queueMutex);
+      _queueReady.wait(lock, [this] { return _stopping || !_connections.empty(); });
+      if (_connections.empty())
+        return;
+      fd = _connections.front();
+      _connections.pop_front();
+      _active.insert(fd);
+    }
+    bool open = _serve(fd);
+    lock_guard<mutex> lock(_queueMutex);
+    _active.erase(fd);
+    if (!open || _stopping) {
+      close(fd);
+      continue;
+    }
+    // back to the poll of run() for its next request
+    _idle.push_back(fd);
+    if (write(_wakePipe[1], "r", 1) < 0) {}
+  }
+}
+
+void PricingServer::stop()
+{
+  lock_guard<mutex> lock(_queueMutex);
+  _stopping = true;
+  // clients stalled in the middle of a request must not hold the workers
+  for (set<int>::iterator it = _active.begin(); it != _active.end(); it++)
+    shutdown(*it, SHUT_RD);
+  _queueReady.notify_all();
+  // wakes run() out of its poll
+  if (_wakePipe[1] >= 0 && write(_wakePipe[1], "s", 1) < 0) {}
+}
+
+bool PricingServer::_listen()
+{
+  if (_wakePipe[0] < 0)
+    return false;
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (_socketPath.size() >= sizeof(addr.sun_path)) {
+    VCAPS_LOG(LOG_ERROR, "Error: socket path " << _socketPath << " too long");
+    return false;
+  }
+  _listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (_listenFd < 0) {
+    VCAPS_LOG(LOG_ERROR, "Error: can not create socket " << _socketPath << ": " << strerror(errno));
+    return false;
+  }
+  strncpy(addr.sun_path, _socketPath.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(_socketPath.c_str());
+  if (bind(_listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listenFd, 64) < 0) {
+    VCAPS_LOG(LOG_ERROR, "Error: can not listen on " << _socketPath << ": " << strerror(errno));
+    close(_listenFd);
+    _listenFd = -1;
+    return false;
+  }
+  return true;
+}
+
+bool PricingServer::run()
+{
+  if (!_listen())
+    return false;
+  // accept only after poll says a connection is pending, and a client
+  //  gone meanwhile must not block it
+  fcntl(_listenFd, F_SETFL, fcntl(_listenFd, F_GETFL) | O_NONBLOCK);
+
+  stopPipe = _wakePipe[1];
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onStopSignal;
+  sigaction(SIGINT, &action, 0);
+  sigaction(SIGTERM, &action, 0);
+  signal(SIGPIPE, SIG_IGN);
+
+  // the stop signals go to this thread, the workers are created with them blocked
+  sigset_t stopSignals, previous;
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT);
+  sigaddset(&stopSignals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopSignals, &previous);
+  vector<std::thread*> pools;
+  for (int i = 0; i < _numThreads; i++)
+    pools.push_back(new thread(&PricingServer::_worker, this));
+  pthread_sigmask(SIG_SETMASK, &previous, 0);
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "\t serving on " << _socketPath << " with "
+       << _numThreads << " threads");
+
+  // the listening socket, the wake pipe, then the connections waiting
+  //  for their next request
+  vector<pollfd> fds(2);
+  fds[0].fd = _listenFd;
+  fds[1].fd = _wakePipe[0];
+  bool stopping = false;
+  while (!stopping) {
+    for (size_t i = 0; i < fds.size(); i++) {
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    if (poll(&fds[0], fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      VCAPS_LOG(LOG_ERROR, "Error: poll on " << _socketPath << ": " << strerror(errno));
+      break;
+    }
+    lock_guard<mutex> lock(_queueMutex);
+    // a stop signal or stop(), or connections given back by the workers
+    if (fds[1].revents) {
+      char wakes[64];
+      ssize_t n;
+      while ((n = read(_wakePipe[0], wakes, sizeof(wakes))) > 0)
+        stopping |= memchr(wakes, 's', n) != 0;
+    }
+    // a request starts on a connection: a worker reads and prices it
+    for (size_t i = fds.size() - 1; i >= 2; i--)
+      if (fds[i].revents) {
+        _connections.push_back(fds[i].fd);
+        _queueReady.notify_one();
+        fds.erase(fds.begin() + i);
+      }
+    for (size_t i = 0; i < _idle.size(); i++) {
+      pollfd p = { _idle[i], POLLIN, 0 };
+      fds.push_back(p);
+    }
+    _idle.clear();
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(_listenFd, 0, 0);
+      if (fd >= 0) {
+        pollfd p = { fd, POLLIN, 0 };
+        fds.push_back(p);
+      }
+    }
+  }
+  stopPipe = -1;
+
+  stop();
+  for_each(pools.begin(), pools.end(), [](std::thread *t) { t->join(); delete t; });
+  for (size_t i = 2; i < fds.size(); i++)
+    close(fds[i].fd);
+  // given back after the poll ended
+  for (size_t i = 0; i < _idle.size(); i++)
+    close(_idle[i]);
+  _idle.clear();
+  close(_listenFd);
+  _listenFd = -1;
+  unlink(_socketPath.c_str());
+  // the wakes of this run must not stop the next one
+  char drained[64];
+  while (read(_wakePipe[0], drained, sizeof(drained)) > 0) {}
+  {
+    lock_guard<mutex> lock(_queueMutex);
+    _stopping = false;
+  }
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "\t server stopped");
+  return true;
+}
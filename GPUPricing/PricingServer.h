@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "pricing.h"
+
+using namespace std;
+
+/*
+  keeps the simulations of a Pricing resident and prices requests sent
+  over a Unix domain socket. A frame is a 4 byte length in network order
+  followed by that many bytes; a connection sends request frames and
+  reads one response frame per request, an empty frame or closing the
+  socket ends it.
+  A request is text, one job file line per contract (see pricing.h), plus
+  optionally a line
+    tvar <tab> comma separated probabilities
+  The response is "ok" and the results table, one line per contract in
+  the order of the request, or "error" <tab> the reason.
+  The requests are served by a pool of threads sharing the read-only
+  simulations; the first request on a simulation loads it. A worker
+  takes one request at a time, its connection is polled again after the
+  reply, so idle clients do not hold the workers
+*/
+class PricingServer
+{
+public:
+  PricingServer(Pricing& pricing, string socketPath, int numThreads);
+  ~PricingServer();
+
+  // accepts connections until stop() or SIGINT/SIGTERM; false, the
+  //  reason logged, if the socket can not be listened on
+  bool run();
+  // from any thread, or before run(), which then returns at once
+  void stop();
+
+  string handleRequest(const string& request);
+
+  // false on end of file or error; the reason in error if the frame is
+  //  oversize or cut, "" on end of file
+  static bool readFrame(int fd, string& payload, string& error);
+  static bool readFrame(int fd, string& payload);
+  static bool writeFrame(int fd, const string& payload);
+
+  // frames above are rejected, so a stray client can not exhaust memory
+  static const unsigned int maxFrameSize = 64 << 20;
+
+private:
+  bool _listen();
+  void _worker();
+  // one request of the connection, false if it is to be closed
+  bool _serve(int fd);
+
+  Pricing& _pricing;
+  string _socketPath;
+  int _numThreads;
+  int _listenFd;
+  // written by stop() and the stop signals to wake the poll of run()
+  int _wakePipe[2];
+
+  mutex _queueMutex;
+  condition_variable _queueReady;
+  // the connections with a request to serve, being served, and given
+  //  back by the workers for run() to poll
+  deque<int> _connections;
+  set<int> _active;
+  vector<int> _idle;
+  bool _stopping;
+};
@@ -0,0 +1,54 @@
+#include "Reduction.h"
+
+#include <omp.h>
+
+namespace VCAPS
+{
+
+static Moments chunkMoments(const double* x, size_t begin, size_t end)
+{
+  Moments m;
+  for (size_t i = begin; i < end; i++)
+    m.add(x[i]);
+  return m;
+}
+
+Moments Reduction::moments(const double* x, size_t n)
+{
+  if (n == 0)
+    return Moments();
+
+  if (!isDeterministic()) {
+    // the team may be smaller than asked for (nested in another
+    //  parallel region, OMP_DYNAMIC, a thread limit): the shares are cut
+    //  once it is formed
+    vector<Moments> partial;
+#pragma omp parallel
+    {
+      int nThreads = omp_get_num_threads(), t = omp_get_thread_num();
+#pragma omp single
+      partial.resize(nThreads);
+      size_t unit = (n + nThreads - 1) / nThreads;
+      size_t begin = (std::min)(n, t * unit);
+      partial[t] = chunkMoments(x, begin, (std::min)(n, begin + unit));
+    }
+    Moments m;
+    for (size_t t = 0; t < partial.size(); t++)
+      m.merge(partial[t]);
+    return m;
+  }
+
+  long nChunks = (long)((n + chunkSize - 1) / chunkSize);
+  vector<Moments> chunks(nChunks);
+#pragma omp parallel for schedule(static)
+  for (long c = 0; c < nChunks; c++)
+    chunks[c] = chunkMoments(x, c * chunkSize, (std::min)(n, (c + 1) * chunkSize));
+
+  // pairwise tree over the chunks, its shape only depends on n
+  for (long step = 1; step < nChunks; step *= 2)
+    for (long c = 0; c + step < nChunks; c += 2 * step)
+      chunks[c].merge(chunks[c + step]);
+  return chunks[0];
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  count, mean and sum of squared deviations of a series (Welford).
+  Two partial results are combined with Chan's pairwise update, so chunks
+  of a series can be reduced independently and merged afterwards
+*/
+struct Moments
+{
+  double n, mean, m2;
+
+  Moments() : n(0), mean(0), m2(0) {}
+
+  void add(double x) {
+    n += 1;
+    double d = x - mean;
+    mean += d / n;
+    m2 += d * (x - mean);
+  }
+
+  void merge(const Moments& other) {
+    if (other.n == 0) return;
+    if (n == 0) { *this = other; return; }
+    double total = n + other.n;
+    double d = other.mean - mean;
+    mean += d * (other.n / total);
+    m2 += other.m2 + d * d * (n * other.n / total);
+    n = total;
+  }
+
+  /*
+    the moments over numIter iterations: the mean is the sum / numIter and
+    the variance (sum of squares - numIter * mean^2) / numIter, whatever
+    the number of observations. The iterations without any loss count as
+    zeros, and more observations than iterations (the keys of
+    ignoreOrdering) still divide by numIter
+  */
+  void normalize(double numIter) {
+    if (numIter <= 0) { *this = Moments(); return; }
+    double shift = n * mean * mean * (1 - n / numIter);
+    mean = mean * n / numIter;
+    m2 += shift;
+    n = numIter;
+  }
+
+  // population variance, as used for the SD of annual losses
+  double variance() const { return n > 0 ? (std::max)(0.0, m2 / n) : 0.; }
+};
+
+/*
+  parallel reductions over series of annual losses.
+  In deterministic mode (the default) the series is cut into fixed size
+  chunks and the chunk results are merged in a fixed pairwise order, so
+  the result is bit-identical whatever the number of threads. Otherwise
+  each thread reduces its own share and the shares are merged per thread.
+*/
+class Reduction
+{
+public:
+  static const size_t chunkSize = 4096;
+
+  static void setDeterministic(bool x) { deterministicFlag() = x; }
+  static bool isDeterministic() { return deterministicFlag(); }
+
+  static Moments moments(const double* x, size_t n);
+  static Moments moments(const vector<double>& x) {
+    return moments(x.empty() ? 0 : &x[0], x.size());
+  }
+
+private:
+  static bool& deterministicFlag() { static bool flag = true; return flag; }
+};
+
+}
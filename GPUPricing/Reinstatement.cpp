@@ -0,0 +1,90 @@
+#include "Reinstatement.h"
+
+#include <omp.h>
+
+namespace VCAPS
+{
+
+static double aggregateTerms(const Layer& layer, double cumulative)
+{
+  return (std::min)((std::max)(cumulative - layer.aggDeductible, 0.0), layer.aggLimit);
+}
+
+void ReinstatementEngine::applyYear(const VirtualYear& gross, double factor, 
+                                    const ScaleFactors& factors, const Layer& layer,
+                                    VirtualYear& ceded)
+{
+  int nReinstatements = (int)layer.reinstatementRates.size();
+  bool hasReinstatements = nReinstatements > 0 && layer.occLimit > 0 
+                           && layer.occLimit < numeric_limits<double>::infinity();
+  double capacity = hasReinstatements ? nReinstatements * layer.occLimit : 0;
+
+  double cumulative = 0, reinstated = 0;
+  const VirtualEvent::MAP& events = gross.get_events();
+  for (VirtualEvent::ConstIterator iE = events.begin(); iE != events.end(); iE++) {
+    double loss = iE->second.loss * factor * factors.of(iE->second);
+    double occurrence = (std::min)((std::max)(loss - layer.occRetention, 0.0), layer.occLimit);
+    if (occurrence == 0)
+      continue;
+    double cededBefore = aggregateTerms(layer, cumulative);
+    cumulative += occurrence;
+    double cededLoss = aggregateTerms(layer, cumulative) - cededBefore;
+    if (cededLoss == 0)
+      continue;
+
+    // reinstatement k restores the part [k, k+1) * occLimit of the
+    //  reinstated amount
+    double rip = 0, fullRip = 0;
+    double toReinstate = (std::min)(cededLoss, capacity - reinstated);
+    if (toReinstate > 0) {
+      double from = reinstated, to = reinstated + toReinstate;
+      for (int k = (int)(from / layer.occLimit); k < nReinstatements; k++) {
+        double overlap = (std::min)(to, (k + 1) * layer.occLimit) 
+                       - (std::max)(from, k * layer.occLimit);
+        if (overlap <= 0)
+          break;
+        double prorata = layer.premium * overlap / layer.occLimit;
+        rip += prorata * layer.reinstatementRates[k];
+        fullRip += prorata;
+      }
+      reinstated = to;
+    }
+
+    VirtualEvent e = VirtualEvent::cataloged(iE->second.catalogId, cededLoss * layer.share,
+                                             rip * layer.share, fullRip * layer.share);
+    ceded.addVirtualEvent(iE->first, e, 1.0, gross.iterId, false);
+  }
+}
+
+Simulation ReinstatementEngine::apply(const Simulation& gross, const Layer& layer)
+{
+  const VirtualYear::MAP& iterations = gross.getIterations();
+  vector<VirtualYear::ConstIterator> years;
+  years.reserve(iterations.size());
+  for (VirtualYear::ConstIterator iI = iterations.begin(); iI != iterations.end(); iI++)
+    years.push_back(iI);
+
+  long nYears = (long)years.size();
+  vector<VirtualYear> cededYears(nYears);
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (long i = 0; i < nYears; i++) {
+    cededYears[i].iterId = years[i]->first;
+    applyYear(years[i]->second, years[i]->second.factor(), gross.get_factors(), layer, cededYears[i]);
+  }
+
+  VirtualYear::MAP cededIterations;
+  for (long i = 0; i < nYears; i++) {
+    if (cededYears[i].size() == 0)
+      continue;
+    VirtualYear::Iterator it = cededIterations.insert(cededIterations.end(), 
+                                 VirtualYear::Pair(years[i]->first, VirtualYear()));
+    it->second.swap(cededYears[i]);
+  }
+
+  Simulation ceded(gross.get_numIter());
+  ceded = cededIterations;
+  ceded.riskGroupMap = gross.riskGroupMap;
+  return ceded;
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "LayerTerms.h"
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  computes the reinstatement premiums of a layer event by event, in
+  sequence order within each year, instead of reading them pre-baked
+  from the simulation file. Reinstatements are paid pro rata as to
+  amount: restoring x of the occurrence limit through reinstatement k
+  costs premium * reinstatementRates[k] * x / occLimit. Years are
+  independent and processed in parallel
+*/
+class ReinstatementEngine
+{
+public:
+  /*
+    the ceded simulation: every event that reaches the layer with 
+      loss              = its ceded loss after the aggregate terms
+      reinstatementPrem = its reinstatement premium
+      fullRip           = its reinstatement premium if all rates were 100%
+    all multiplied by the layer share
+  */
+  static Simulation apply(const Simulation& gross, const Layer& layer);
+
+  static void applyYear(const VirtualYear& gross, double factor, const ScaleFactors& factors,
+                        const Layer& layer, VirtualYear& ceded);
+};
+
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <cctype>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  process wide interning of risk group names to small integer ids, so
+  per-event filtering and grouping compare ints instead of strings.
+  Ids are stable for the life of the process and shared by all
+  simulations; lookups go through a per-thread cache first so loader
+  threads do not contend on the lock. The kind of a group (terror,
+  Noncat-) is worked out from its name once, when it is interned
+*/
+class RiskGroupTable
+{
+public:
+  static int intern(const string& rg) {
+    static thread_local unordered_map<string, int> cache;
+    unordered_map<string, int>::iterator ic = cache.find(rg);
+    if (ic != cache.end())
+      return ic->second;
+
+    Registry& r = registry();
+    int id;
+    {
+      lock_guard<mutex> lck(r.mtx);
+      unordered_map<string, int>::iterator i = r.ids.find(rg);
+      if (i != r.ids.end())
+        id = i->second;
+      else {
+        id = (int)r.names.size();
+        r.names.push_back(rg);
+        r.flags.push_back(_flagsOf(rg));
+        r.ids[rg] = id;
+        r.count = id + 1;
+      }
+    }
+    cache[rg] = id;
+    return id;
+  }
+
+  static const string& name(int id) {
+    Registry& r = registry();
+    lock_guard<mutex> lck(r.mtx);
+    return r.names[id];
+  }
+
+  // number of ids handed out so far, ids are 0..size()-1
+  static int size() { return registry().count; }
+
+  // id of the default "NA" risk group
+  static int na() { static const int id = intern("NA"); return id; }
+
+  // the name ends with TERR, in any case
+  static bool isTerror(int id) { return (flags(id) & Terror) != 0; }
+  // a Noncat-<mfid> group, see VirtualYear::addVirtualEvent
+  static bool isNoncat(int id) { return (flags(id) & Noncat) != 0; }
+
+private:
+  enum Flags { Terror = 1, Noncat = 2 };
+
+  struct Registry {
+    Registry() : count(0) {}
+    mutex mtx;
+    unordered_map<string, int> ids;
+    deque<string> names;
+    vector<unsigned char> flags;
+    atomic<int> count;
+  };
+
+  static unsigned char _flagsOf(const string& rg) {
+    unsigned char f = 0;
+    if (rg.size() >= 4) {
+      string suffix = rg.substr(rg.size() - 4);
+      for (size_t i = 0; i < suffix.size(); i++)
+        suffix[i] = (char)toupper((unsigned char)suffix[i]);
+      if (suffix == "TERR")
+        f |= Terror;
+    }
+    if (rg.find("Noncat-") != string::npos)
+      f |= Noncat;
+    return f;
+  }
+
+  // per-thread copy of the flags, refreshed when an id is newer than it
+  static unsigned char flags(int id) {
+    static thread_local vector<unsigned char> cache;
+    if (id >= (int)cache.size()) {
+      Registry& r = registry();
+      lock_guard<mutex> lck(r.mtx);
+      cache = r.flags;
+    }
+    return cache[id];
+  }
+
+  static Registry& registry() { static Registry r; return r; }
+};
+
+}
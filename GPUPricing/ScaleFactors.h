@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+#include "VirtualEvent.h"
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  multiplicative factors not yet applied to the loss and reinstatement
+  premium of events: one for all events and one per risk group id.
+  Currency and trend factors are recorded here in O(1) and applied when
+  an aggregate reads the events, or all at once by materialize()
+*/
+struct ScaleFactors
+{
+  double all;
+  vector<double> byRiskGroup; // indexed by RiskGroupTable id, empty if none
+
+  ScaleFactors() : all(1) {}
+
+  bool identity() const { return all == 1 && byRiskGroup.empty(); }
+  bool uniform() const { return byRiskGroup.empty(); }
+
+  double of(int rgId) const {
+    return rgId < (int)byRiskGroup.size() ? all * byRiskGroup[rgId] : all;
+  }
+  double of(const VirtualEvent& e) const { return of(e.rgId()); }
+
+  void scale(double factor) { all *= factor; }
+  void scale(double factor, int rgId) {
+    if (rgId >= (int)byRiskGroup.size())
+      byRiskGroup.resize(rgId + 1, 1.0);
+    byRiskGroup[rgId] *= factor;
+  }
+  void scale(const ScaleFactors& other) {
+    all *= other.all;
+    for (int id = 0; id < (int)other.byRiskGroup.size(); id++)
+      if (other.byRiskGroup[id] != 1)
+        scale(other.byRiskGroup[id], id);
+  }
+
+  void apply(VirtualEvent& e) const {
+    double factor = of(e.rgId());
+    if (factor != 1)
+      e *= factor;
+  }
+
+  void clear() { all = 1; byRiskGroup.clear(); }
+};
+
+}
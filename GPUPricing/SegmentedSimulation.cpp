@@ -0,0 +1,373 @@
+#include "SegmentedSimulation.h"
+#include "Trace.h"
+#include "Log.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <omp.h>
+
+namespace VCAPS
+{
+
+string SegmentedSimulation::_segmentFile(int k) const
+{
+  stringstream ss;
+  ss << _directory << "/segment_" << k << ".evt";
+  return ss.str();
+}
+
+// one spilled row: the fixed fields, then the risk group '\0' terminated
+struct SpilledRow
+{
+  VLONG iterId;
+  int seqId, eventId;
+  double loss, reinstatementPrem, fullRip;
+};
+
+// a field ends at a tab, or at the end of the line for the last one
+static bool fieldEnd(char*& p, char* end, bool last)
+{
+  if (end == p)
+    return false;
+  if (last ? *end != '\0' && *end != '\r' : *end != '\t')
+    return false;
+  p = last ? end : end + 1;
+  return true;
+}
+
+static bool parseField(char*& p, bool last, VLONG& value)
+{
+  char* end;
+  errno = 0;
+  value = strtoll(p, &end, 10);
+  return errno == 0 && fieldEnd(p, end, last);
+}
+
+static bool parseField(char*& p, bool last, int& value)
+{
+  VLONG v;
+  if (!parseField(p, last, v) || v < INT_MIN || v > INT_MAX)
+    return false;
+  value = (int)v;
+  return true;
+}
+
+static bool parseField(char*& p, bool last, double& value)
+{
+  char* end;
+  value = strtod(p, &end);
+  return fieldEnd(p, end, last);
+}
+
+// the fields of a text row as the loader of Simulation reads them, false
+//  if one is missing or not a number
+static bool parseRow(char* p, bool hasRG, bool hasFullRip, SpilledRow& row, string& riskGroup)
+{
+  if (!parseField(p, false, row.iterId) || !parseField(p, false, row.seqId)
+      || !parseField(p, false, row.eventId) || !parseField(p, false, row.loss)
+      || !parseField(p, !hasRG, row.reinstatementPrem))
+    return false;
+  riskGroup = "NA";
+  row.fullRip = 0;
+  if (!hasRG)
+    return true;
+  char* end = strchr(p, '\t');
+  if (hasFullRip != (end != 0))
+    return false;
+  riskGroup = end ? string(p, end) : string(p);
+  if (!riskGroup.empty() && riskGroup[riskGroup.size() - 1] == '\r')
+    riskGroup.erase(riskGroup.size() - 1);
+  if (!hasFullRip)
+    return true;
+  p = end + 1;
+  return parseField(p, true, row.fullRip);
+}
+
+bool SegmentedSimulation::partition(const string& simulationFile, const string& directory,
+                                    size_t memoryBudget, double minLossToInclude)
+{
+  TRACE_SCOPE("partition");
+  ifstream in(simulationFile.c_str());
+  struct stat st;
+  if (!in || stat(simulationFile.c_str(), &st) != 0) {
+    cerr << "Error: text file " << simulationFile << " not openable" << endl;
+    return false;
+  }
+  string line;
+  getline(in, line);
+  stringstream first(line);
+  string word1, word2;
+  VLONG numIter = 0;
+  first >> word1 >> word2 >> numIter;
+  if (word1 != "_numIter" || word2 != "=" || numIter <= 0) {
+    cerr << "Error: the first line of " + simulationFile + " must be\n_numIter = <n>" << endl;
+    return false;
+  }
+  getline(in, line);
+  size_t numFields = std::count(line.begin(), line.end(), '\t') + 1;
+  bool hasRG = numFields >= 6, hasFullRip = numFields == 7;
+
+  mkdir(directory.c_str(), 0755);
+  _directory = directory;
+  _numIter = numIter;
+  _numSegments = 0;
+  VLONG wanted = (std::min)(numIter, (VLONG)((size_t)st.st_size * mapOverhead / memoryBudget + 1));
+  // all the spill files are open at once: stay well below the fd limit
+  VLONG maxSegments = maxOpenSegments;
+  struct rlimit fds;
+  if (getrlimit(RLIMIT_NOFILE, &fds) == 0 && fds.rlim_cur != RLIM_INFINITY)
+    maxSegments = (std::min)(maxSegments, (std::max)((VLONG)1, (VLONG)fds.rlim_cur / 4));
+  if (wanted > maxSegments)
+    VCAPS_LOG(LOG_WARN, "Warning: " << wanted << " segments needed for the memory budget, "
+         << maxSegments << " used");
+  int numSegments = (int)(std::min)(wanted, maxSegments);
+  VLONG yearsPerSegment = (numIter + numSegments - 1) / numSegments;
+
+  vector<FILE*> spills(numSegments, (FILE*)0);
+  vector<string> spillNames(numSegments);
+  // on failure the spills go, and the segment files written so far
+  auto fail = [&](const string& error) {
+    cerr << "Error: " << error << endl;
+    for (int k = 0; k < numSegments; k++) {
+      if (spills[k])
+        fclose(spills[k]);
+      remove(spillNames[k].c_str());
+      remove(_segmentFile(k).c_str());
+    }
+    remove((directory + "/segments.txt").c_str());
+    return false;
+  };
+  size_t spillBuffer = (std::max)((size_t)4096, memoryBudget / 4 / numSegments);
+  for (int k = 0; k < numSegments; k++) {
+    spillNames[k] = _segmentFile(k) + ".rows";
+    spills[k] = fopen(spillNames[k].c_str(), "wb");
+    if (!spills[k])
+      return fail("can not create " + spillNames[k] + ": " + strerror(errno));
+    setvbuf(spills[k], 0, _IOFBF, spillBuffer);
+  }
+
+  long nRows = 0, lineNo = 2;
+  SpilledRow row;
+  string riskGroup;
+  while (getline(in, line)) {
+    lineNo++;
+    if (line.empty())
+      continue;
+    if (!parseRow(&line[0], hasRG, hasFullRip, row, riskGroup)) {
+      stringstream ss;
+      ss << "malformed row " << lineNo << " in " << simulationFile;
+      return fail(ss.str());
+    }
+    if (row.iterId < 0 || row.iterId >= numIter) {
+      stringstream ss;
+      ss << "iteration " << row.iterId << " of row " << lineNo << " outside the _numIter "
+         << numIter << " of " << simulationFile;
+      return fail(ss.str());
+    }
+    if (row.loss < minLossToInclude)
+      continue;
+    string upper = riskGroup;
+    transform(upper.begin(), upper.end(), upper.begin(), (int(*)(int)) toupper);
+    if (upper == "NONCAT")
+      riskGroup = "Noncat";
+
+    int k = (int)(row.iterId / yearsPerSegment);
+    if (fwrite(&row, sizeof(row), 1, spills[k]) != 1
+        || fwrite(riskGroup.c_str(), 1, riskGroup.size() + 1, spills[k]) != riskGroup.size() + 1)
+      return fail("can not write " + spillNames[k] + ": " + strerror(errno));
+    nRows++;
+  }
+  if (in.bad())
+    return fail("can not read " + simulationFile);
+  // the buffered rows are written by fclose
+  for (int k = 0; k < numSegments; k++) {
+    int closed = fclose(spills[k]);
+    spills[k] = 0;
+    if (closed != 0)
+      return fail("can not write " + spillNames[k] + ": " + strerror(errno));
+  }
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "\t spilled " << nRows << " rows of " << simulationFile
+       << " into " << numSegments << " segments");
+
+  // one segment in memory at a time
+  for (int k = 0; k < numSegments; k++) {
+    Simulation segment(numIter);
+    spills[k] = fopen(spillNames[k].c_str(), "rb");
+    if (!spills[k])
+      return fail("can not read " + spillNames[k] + ": " + strerror(errno));
+    int c = 0;
+    size_t got;
+    while ((got = fread(&row, 1, sizeof(row), spills[k])) == sizeof(row)) {
+      riskGroup.clear();
+      while ((c = fgetc(spills[k])) > 0)
+        riskGroup += (char)c;
+      if (c != 0)
+        break;
+      if (!segment.addVirtualEvent(row.iterId, row.seqId,
+            VirtualEvent(row.eventId, row.loss, row.reinstatementPrem, riskGroup, row.fullRip))) {
+        stringstream ss;
+        ss << "event " << row.eventId << " of iteration " << row.iterId << " not added";
+        return fail(ss.str());
+      }
+    }
+    // a row cut short, or a read error
+    if (got != 0 || c != 0 || ferror(spills[k]))
+      return fail("can not read " + spillNames[k]);
+    fclose(spills[k]);
+    spills[k] = 0;
+    remove(spillNames[k].c_str());
+    if (!EventTable(segment).save(_segmentFile(k)))
+      return fail("can not save " + _segmentFile(k));
+  }
+
+  ofstream manifest((directory + "/segments.txt").c_str());
+  manifest << "_numIter = " << _numIter << endl << "_numSegments = " << numSegments << endl;
+  manifest.close();
+  if (!manifest)
+    return fail("can not write " + directory + "/segments.txt");
+  _numSegments = numSegments;
+  return true;
+}
+
+bool SegmentedSimulation::open(const string& directory)
+{
+  ifstream manifest((directory + "/segments.txt").c_str());
+  string word1, word2, word3, word4;
+  VLONG numIter = 0;
+  int numSegments = 0;
+  manifest >> word1 >> word2 >> numIter >> word3 >> word4 >> numSegments;
+  if (word1 != "_numIter" || word3 != "_numSegments" || numSegments <= 0) {
+    cerr << "Error: " << directory << " has no segments" << endl;
+    return false;
+  }
+  _directory = directory;
+  _numIter = numIter;
+  _numSegments = numSegments;
+  return true;
+}
+
+bool SegmentedSimulation::loadSegment(int k, EventTable& table) const
+{
+  if (!EventTable::load(_segmentFile(k), table)) {
+    cerr << "Error: segment " << _segmentFile(k) << " not readable" << endl;
+    return false;
+  }
+  return true;
+}
+
+bool SegmentedSimulation::get_expected_sd(EL_SD& elsd, bool includeReinstatePrem) const
+{
+  Moments total;
+  for (int s = 0; s < _numSegments; s++) {
+    TRACE_SCOPE("segment");
+    EventTable table;
+    if (!loadSegment(s, table))
+      return false;
+    long nYears = (long)table.numYears();
+    vector<double> annual(nYears);
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (long y = 0; y < nYears; y++) {
+      double loss = 0;
+      for (size_t k = table.yearOffsets[y]; k < table.yearOffsets[y + 1]; k++)
+        loss += includeReinstatePrem ? table.losses[k] - table.reinstatementPrems[k] : table.losses[k];
+      annual[y] = loss;
+    }
+    total.merge(Reduction::moments(annual));
+  }
+  total.normalize((double)_numIter);
+  elsd = EL_SD(total.mean, sqrt(total.variance()));
+  return true;
+}
+
+bool SegmentedSimulation::aggregateByRiskGroup(map<string, AnnualLoss>& annualLosses,
+                                               bool includeReinstatePrem) const
+{
+  annualLosses.clear();
+  for (int s = 0; s < _numSegments; s++) {
+    TRACE_SCOPE("segment");
+    EventTable table;
+    if (!loadSegment(s, table))
+      return false;
+    int nGroups = (int)table.riskGroups.size();
+    vector<AnnualLoss*> byId(nGroups);
+    for (int g = 0; g < nGroups; g++) {
+      AnnualLoss& group = annualLosses[table.riskGroups[g]];
+      group.set_numIter(_numIter);
+      byId[g] = &group;
+    }
+
+    // each chunk sums a contiguous range of years per risk group, then
+    //  the groups are filled in parallel. Fixed chunks, not one per
+    //  thread: the team may be smaller than omp_get_max_threads()
+    typedef vector< pair<VLONG, double> > ENTRIES; // (iterId, annual loss)
+    long nYears = (long)table.numYears();
+    const long chunkYears = 4096;
+    long nChunks = (nYears + chunkYears - 1) / chunkYears;
+    vector< vector<ENTRIES> > partial(nChunks, vector<ENTRIES>(nGroups));
+#pragma omp parallel for schedule(dynamic, 1)
+    for (long c = 0; c < nChunks; c++) {
+      vector<ENTRIES>& local = partial[c];
+      long end = (std::min)(nYears, (c + 1) * chunkYears);
+      for (long y = c * chunkYears; y < end; y++) {
+        VLONG iterId = table.yearIds[y];
+        for (size_t k = table.yearOffsets[y]; k < table.yearOffsets[y + 1]; k++) {
+          ENTRIES& entries = local[table.rgIds[k]];
+          double loss = includeReinstatePrem ? table.losses[k] - table.reinstatementPrems[k]
+                                             : table.losses[k];
+          if (entries.empty() || entries.back().first != iterId)
+            entries.push_back(pair<VLONG, double>(iterId, loss));
+          else
+            entries.back().second += loss;
+        }
+      }
+    }
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int g = 0; g < nGroups; g++) {
+      AnnualLoss::MAP& losses = byId[g]->get_annualLoss();
+      for (long c = 0; c < nChunks; c++)
+        losses.insert(partial[c][g].begin(), partial[c][g].end());
+    }
+  }
+  return true;
+}
+
+bool SegmentedSimulation::get_expected_sd(map<string, EL_SD>& elsd, bool includeReinstatePrem) const
+{
+  map<string, AnnualLoss> annualLosses;
+  elsd.clear();
+  if (!aggregateByRiskGroup(annualLosses, includeReinstatePrem))
+    return false;
+  for (map<string, AnnualLoss>::iterator i = annualLosses.begin(); i != annualLosses.end(); i++)
+    elsd[i->first] = i->second.get_expected_sd();
+  return true;
+}
+
+bool SegmentedSimulation::applyLayers(const vector<Layer>& layers,
+                                      vector<AnnualLoss>& annualLosses) const
+{
+  annualLosses.assign(layers.size(), AnnualLoss(_numIter));
+  for (int s = 0; s < _numSegments; s++) {
+    TRACE_SCOPE("segment");
+    EventTable table;
+    if (!loadSegment(s, table))
+      return false;
+    vector<AnnualLoss> partial;
+    LayerTermsEngine(table).apply(layers, partial);
+    // the segments hold disjoint years
+    for (size_t l = 0; l < layers.size(); l++) {
+      AnnualLoss::MAP& losses = annualLosses[l].get_annualLoss();
+      const AnnualLoss::MAP& segment = partial[l].get_annualLoss();
+      losses.insert(segment.begin(), segment.end());
+    }
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "EventTable.h"
+#include "LayerTerms.h"
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  out-of-core simulation: the years are partitioned by iteration ID into
+  segments saved on disk as EventTable images (segment_<k>.evt, plus
+  segments.txt with the number of iterations and of segments), and the
+  aggregates stream over them one segment at a time. Only one segment is
+  in memory at once, mapped read-only, so the memory budget given to
+  partition() bounds the run instead of the size of the simulation.
+  The years of a segment are complete, so annual losses never straddle
+  two segments
+*/
+class SegmentedSimulation
+{
+public:
+  SegmentedSimulation() : _numIter(0), _numSegments(0) {}
+
+  /*
+    reads a simulation text file (same format as Simulation::readFromFile)
+    row by row, spilling the rows to one file per segment, then turns each
+    spill into a segment. A segment is sized so that building it as a
+    Simulation takes about memoryBudget bytes. False, the reason on cerr
+    and the files written so far removed, on a malformed row, an iteration
+    outside 0.._numIter-1 or an I/O error
+  */
+  bool partition(const string& simulationFile, const string& directory,
+                 size_t memoryBudget, double minLossToInclude = 0);
+  // the segments written by partition in directory
+  bool open(const string& directory);
+
+  VLONG get_numIter() const { return _numIter; }
+  int numSegments() const { return _numSegments; }
+  bool loadSegment(int k, EventTable& table) const;
+
+  // the aggregates are false if a segment can not be loaded
+  bool get_expected_sd(EL_SD& elsd, bool includeReinstatePrem=1) const;
+  bool aggregateByRiskGroup(map<string, AnnualLoss>& annualLosses,
+                            bool includeReinstatePrem=1) const;
+  bool get_expected_sd(map<string, EL_SD>& elsd, bool includeReinstatePrem=1) const;
+  // the ceded annual losses of each layer, as LayerTermsEngine::apply
+  bool applyLayers(const vector<Layer>& layers, vector<AnnualLoss>& annualLosses) const;
+
+  // Simulation-to-text-file overhead of the years of a segment
+  static const int mapOverhead = 4;
+  // partition() keeps a spill file open per segment: at most this many
+  //  segments, and a quarter of the open file limit
+  static const int maxOpenSegments = 1024;
+
+private:
+  string _segmentFile(int k) const;
+
+  string _directory;
+  VLONG _numIter;
+  int _numSegments;
+};
+
+}
@@ -1,6 +1,7 @@
 #include "Simulation.h"
 
-#include <cctype> // for toupper
+#include <cstring>
+#include <strings.h> // for strcasecmp
 #include <algorithm>
 #include <functional>
 #include <chrono>
@@ -9,27 +10,54 @@
 #include <iostream>
 
 #include "csvReader.h"
+#include "SimulationView.h"
+#include "EventList.h"
+#include "LoadMetrics.h"
+#include "Trace.h"
+#include "Log.h"
+
+#include <omp.h>
 
 using namespace chrono;
 
 namespace VCAPS
 {
 
-Simulation::Simulation(int numIter)
+Simulation::Simulation(VLONG numIter)
+  : _iterations(make_shared<VirtualYear::MAP>()), _numIter(numIter)
 {
-  _numIter = numIter;
+  _counted.set();
 }
   
 const int workers = 12;
 csv_io::CSVReader<7, workers, '\t'> thread_input;
 VirtualYear::MAP thread_iterations[workers];
 Simulation::RGMAP thread_riskGroupMap[workers];
-
-void readFileThread(int idx, int memSize, double minLossToInclude, string mfid, 
-                    bool ignoreOrdering, bool hasRG, bool hasFullRip, double fullRipScale)
+// the rows read ignoring the ordering, one flat list per thread
+EventList thread_events[workers];
+LoadMetrics::Thread thread_metrics[workers];
+// the first error of each thread, "" if none: the load fails instead of
+//  exiting, so a long running process survives a bad file
+string thread_errors[workers];
+// events inserted per RiskGroupTable id
+vector<VLONG> thread_counts[workers];
+
+// where the fullRip of a row comes from
+enum FullRipSource { FullRipColumn, FullRipIsLoss, FullRipZero, FullRipScaled };
+
+/*
+  one loader thread, compiled for each file layout and option set so the
+  per-row decode has no tests on them: the row is at fixed offsets up to
+  the risk group, and the risk group is only normalized when it changes
+*/
+template<bool hasRG, int fullRipSource, bool filterRipAndRG, bool ignoreOrdering>
+void readFileThread(int idx, int memSize, double minLossToInclude, string mfid,
+                    double fullRipScale)
 {
-  high_resolution_clock::time_point _start = high_resolution_clock::now();
-  int tt = 0;
+  TRACE_SCOPE("parse");
+  LoadMetrics::Thread& metrics = thread_metrics[idx];
+  metrics = LoadMetrics::Thread();
+  long long parseNs = 0, insertNs = 0;
 
   VirtualYear::MAP& thread_iters = thread_iterations[idx];
 
@@ -39,86 +67,193 @@ void readFileThread(int idx, int memSize, double minLossToInclude, string mfid,
   Simulation::RGMAP& thread_rgMap = thread_riskGroupMap[idx];
   thread_rgMap.clear();
 
-  char* data = new char[memSize];
+  EventList& thread_list = thread_events[idx];
+  thread_list = EventList();
+
+  vector<VLONG>& counts = thread_counts[idx];
 
-  int nTotalEvents = 0;
-  bool filterRipAndRG = (mfid.size()>0);
-  VLONG iterId = 0;
-  int eventId = 0, seqId = 0;
-  double loss = 0, reinstatementPrem = 0, fullRip = 0;
-  string riskGroup = "NA";
-  bool firstIter = true;
-  while (thread_input.read_row((void*)data,idx)) {
-    double loss1 = 0, rip = 0;
+  string& error = thread_errors[idx];
+  error.clear();
 
+  char* data = new char[memSize];
+
+  long nTotalEvents = 0, nRows = 0;
+  // the risk group as in the file (no row has a newline), and as kept
+  string fileRiskGroup = "\n", riskGroup = "NA";
+  int rgId = RiskGroupTable::intern(riskGroup);
+  bool rgListed = false;
+  counts.assign(rgId + 1, 0);
+  // the clock is read around the inserts only: the time from the end of
+  //  an insert to the start of the next is parse, filtered rows included
+  high_resolution_clock::time_point _row = high_resolution_clock::now();
+  while (true) {
+    // after an error the rest of the rows are only drained
+    try {
+      if (!thread_input.read_row((void*)data,idx))
+        break;
+    }
+    catch (exception& e) {
+      if (error.empty())
+        error = string("malformed row: ") + e.what();
+      continue;
+    }
+    catch (...) {
+      if (error.empty())
+        error = "malformed row";
+      continue;
+    }
+    if (!error.empty())
+      continue;
+    nRows++;
     char* p = (char*)data;
-    iterId = *((int*)p); p += sizeof(int);
-    seqId = *((int*)p); p += sizeof(int);
-    eventId = *((int*)p); p += sizeof(int);
-    loss = *((double*)p); p += sizeof(double);
-    reinstatementPrem = *((double*)p); p += sizeof(double);
-    if (hasRG){
-      riskGroup = p; p += riskGroup.length() + 1;
-      if (filterRipAndRG && riskGroup == "Noncat")
-        riskGroup = "Noncat-" + mfid;
+    VLONG iterId = *((long*)p); p += sizeof(long);
+    int seqId = *((int*)p); p += sizeof(int);
+    int eventId = *((int*)p); p += sizeof(int);
+    double loss = *((double*)p); p += sizeof(double);
+    double reinstatementPrem = *((double*)p); p += sizeof(double);
+    if (hasRG) {
+      size_t length = strlen(p);
+      if (fileRiskGroup.compare(0, string::npos, p, length) != 0) {
+        fileRiskGroup.assign(p, length);
+        riskGroup = fileRiskGroup;
+        if (filterRipAndRG && riskGroup == "Noncat")
+          riskGroup = "Noncat-" + mfid;
+        else if (strcasecmp(riskGroup.c_str(), "NONCAT") == 0)
+          riskGroup = "Noncat";
+        rgId = RiskGroupTable::intern(riskGroup);
+        rgListed = false;
+        if (rgId >= (int)counts.size())
+          counts.resize(rgId + 1, 0);
+      }
+      p += length + 1;
     }
 
-    if (hasFullRip)
+    double fullRip = 0;
+    if (fullRipSource == FullRipColumn)
       fullRip = *((double*)p);
-    else if (fullRipScale == 1)
+    else if (fullRipSource == FullRipIsLoss)
       fullRip = loss;
-    else if (fullRipScale == 0)
-      fullRip = 0;
-    else
+    else if (fullRipSource == FullRipScaled)
       fullRip = loss * fullRipScale;
     if (filterRipAndRG && fabs(reinstatementPrem) < 1)
       reinstatementPrem = 0.0;
     if (loss >= minLossToInclude) {
-      string rgTmp = riskGroup;
-      transform(rgTmp.begin(), rgTmp.end(), rgTmp.begin(), (int(*)(int)) toupper);
-      if (rgTmp == "NONCAT")
-        riskGroup = "Noncat";
-      thread_rgMap[riskGroup] = 1;
-        
-      VLONG oldIterId = iterId;
-      if (ignoreOrdering)
-        iterId = ((oldIterId+1) << 32) | seqId;
-      
-      high_resolution_clock::time_point _start = high_resolution_clock::now();
-      VirtualEvent v(eventId, loss, reinstatementPrem, riskGroup, fullRip);
-      thread_iters[iterId].addVirtualEvent(seqId, v, 1.0, iterId, true);
-
-      nanoseconds ns = duration_cast<nanoseconds>(high_resolution_clock::now() - _start);
-      
-      tt += ns.count();
+      if (!rgListed) {
+        thread_rgMap[riskGroup] = 1;
+        rgListed = true;
+      }
+
+      high_resolution_clock::time_point _insert = high_resolution_clock::now();
+      parseNs += duration_cast<nanoseconds>(_insert - _row).count();
+      // one year per event: the row is kept flat, the year ID is EventList::key
+      if (ignoreOrdering) {
+        if (iterId < 0 || iterId >= 0x7fffffffLL) {
+          stringstream ss;
+          ss << "iteration " << iterId << " too large to ignore the ordering";
+          error = ss.str();
+          continue;
+        }
+        thread_list.push_back(iterId, seqId, eventId, loss, reinstatementPrem, rgId, fullRip);
+      }
+      else {
+        int catalogId = EventCatalog::intern(eventId, rgId);
+        if (catalogId < 0) {
+          error = "the event catalog is full";
+          continue;
+        }
+        VirtualEvent v = VirtualEvent::cataloged(catalogId, loss, reinstatementPrem, fullRip);
+        VirtualYear& year = thread_iters[iterId];
+        int before = year.size();
+        if (!year.addVirtualEvent(seqId, v, 1.0, iterId, true)) {
+          stringstream ss;
+          ss << "event " << eventId << " of iteration " << iterId << " not added";
+          error = ss.str();
+          continue;
+        }
+        if (year.size() > before)
+          counts[rgId]++;
+      }
+      _row = high_resolution_clock::now();
+      insertNs += duration_cast<nanoseconds>(_row - _insert).count();
+
       nTotalEvents++;
       if (nTotalEvents % 1000000 == 0)
-        cerr << "Thread" << idx << " : " << nTotalEvents << " events read" << endl;
+        VCAPS_LOG(LOG_INFO, "Thread" << idx << " : " << nTotalEvents << " events read");
     }
   }
+  parseNs += duration_cast<nanoseconds>(high_resolution_clock::now() - _row).count();
   delete[] data;
+
+  metrics.rowsParsed = nRows;
+  metrics.rowsKept = nTotalEvents;
+  // the refills and the waits for them happen in read_row
+  long long blockedNs = thread_input.get_io_nanoseconds(idx) + thread_input.get_wait_nanoseconds(idx);
+  metrics.waitMs = thread_input.get_wait_nanoseconds(idx) / 1e6;
+  metrics.parseMs = (std::max)(0LL, parseNs - blockedNs) / 1e6;
+  metrics.insertMs = insertNs / 1e6;
 }
 
-void Simulation::parallelFileReading(string filename, double minLossToInclude, string mfid,
-                    bool ignoreOrdering, double fullRipScale)
+typedef void (*READER)(int idx, int memSize, double minLossToInclude, string mfid,
+                       double fullRipScale);
+
+// the readFileThread instance for the flags, chosen once per file
+template<bool hasRG, int fullRipSource>
+static READER selectReader(bool filterRipAndRG, bool ignoreOrdering)
+{
+  if (filterRipAndRG)
+    return ignoreOrdering ? readFileThread<hasRG, fullRipSource, true, true>
+                          : readFileThread<hasRG, fullRipSource, true, false>;
+  return ignoreOrdering ? readFileThread<hasRG, fullRipSource, false, true>
+                        : readFileThread<hasRG, fullRipSource, false, false>;
+}
+
+template<bool hasRG>
+static READER selectReader(int fullRipSource, bool filterRipAndRG, bool ignoreOrdering)
 {
+  switch (fullRipSource) {
+  case FullRipColumn: return selectReader<hasRG, FullRipColumn>(filterRipAndRG, ignoreOrdering);
+  case FullRipIsLoss: return selectReader<hasRG, FullRipIsLoss>(filterRipAndRG, ignoreOrdering);
+  case FullRipZero: return selectReader<hasRG, FullRipZero>(filterRipAndRG, ignoreOrdering);
+  default: return selectReader<hasRG, FullRipScaled>(filterRipAndRG, ignoreOrdering);
+  }
+}
+
+static READER selectReader(bool hasRG, bool hasFullRip, double fullRipScale,
+                           bool filterRipAndRG, bool ignoreOrdering)
+{
+  int fullRipSource = hasFullRip ? FullRipColumn : fullRipScale == 1 ? FullRipIsLoss
+                      : fullRipScale == 0 ? FullRipZero : FullRipScaled;
+  return hasRG ? selectReader<true>(fullRipSource, filterRipAndRG, ignoreOrdering)
+               : selectReader<false>(fullRipSource, filterRipAndRG, ignoreOrdering);
+}
+
+// reads filename with the loader threads, which leave what they read in
+//  thread_iterations / thread_events and thread_riskGroupMap; false, the
+//  reason on cerr, if the file is malformed
+static bool readInThreads(string filename, double minLossToInclude, string mfid,
+                          bool ignoreOrdering, double fullRipScale, VLONG& numIter)
+{
+  TRACE_SCOPE("read");
   std::string cols[] = { "iterId", "seqId", "eventId", "loss", "reinstatementPrem", "riskGroup", "fullRip" };
-  csv_io::ColumnType colTypes[] = { csv_io::Int, csv_io::Int, csv_io::Int,
+  csv_io::ColumnType colTypes[] = { csv_io::Long, csv_io::Int, csv_io::Int,
                 csv_io::Double, csv_io::Double, csv_io::String, csv_io::Double };
   thread_input.open(filename);
 
   string line1 = thread_input.bypass_row();
   std::stringstream ss(line1);
   string word1, word2;
-  ss >> word1 >> word2 >> _numIter;
+  numIter = 0;
+  ss >> word1 >> word2 >> numIter;
   if (word1 != "_numIter" || word2 != "=") {
     cerr << "Error: the first line of " + filename + " must be\n_numIter = <n>" << endl;
-    exit(0);
+    thread_input.close();
+    return false;
   }
-  if (_numIter == 0) {
+  if (numIter == 0) {
     cerr << "programFinished" << endl
       << "Error:  " + filename + " must have nonzero _numIter." << endl;
-    exit(0);
+    thread_input.close();
+    return false;
   }
 
   string line2 = thread_input.bypass_row();
@@ -126,185 +261,663 @@ void Simulation::parallelFileReading(string filename, double minLossToInclude, s
   bool hasRG = numFields >= 6;
   bool hasFullRip = numFields == 7;
 
-  cout << "hasRG = " << hasRG << "; hasFullRip = " << hasFullRip
-    << "; ignoreOrdering=" << ignoreOrdering << endl;
+  VCAPS_LOG(LOG_INFO, "hasRG = " << hasRG << "; hasFullRip = " << hasFullRip
+    << "; ignoreOrdering=" << ignoreOrdering);
 
   unsigned int numCol = 5 + (hasRG ? 1 : 0) + (hasFullRip ? 1 : 0);
   if (!hasRG)
     colTypes[5] = csv_io::Double;
   size_t memSize = thread_input.set_header(cols, colTypes, numCol);
 
+  high_resolution_clock::time_point _start = high_resolution_clock::now();
+  READER reader = selectReader(hasRG, hasFullRip, fullRipScale, mfid.size() > 0, ignoreOrdering);
   vector<std::thread*> pools;
   for (int i = 0; i < workers; i++) {
-    std::thread* t = new thread(readFileThread, i, memSize, minLossToInclude, mfid, 
-      ignoreOrdering, hasRG, hasFullRip, fullRipScale);
+    std::thread* t = new thread(reader, i, memSize, minLossToInclude, mfid, fullRipScale);
     pools.push_back(t);
   }
 
   std::this_thread::sleep_for(nanoseconds(1000)); // 1 micro-second
 
   for_each(pools.begin(), pools.end(), [](std::thread *t) { t->join(); delete t; });
+
+  LoadMetrics& metrics = LoadMetrics::last();
+  metrics = LoadMetrics();
+  metrics.file = filename;
+  metrics.bytesRead = thread_input.get_bytes_read();
+  metrics.ioMs = thread_input.get_io_nanoseconds() / 1e6;
+  metrics.readMs = duration_cast<nanoseconds>(high_resolution_clock::now() - _start).count() / 1e6;
+  metrics.threads.assign(thread_metrics, thread_metrics + workers);
+  thread_input.close();
+  for (int i = 0; i < workers; i++)
+    if (!thread_errors[i].empty()) {
+      cerr << "Error: " << thread_errors[i] << " in " << filename << endl;
+      for (int j = 0; j < workers; j++) {
+        VirtualYear::MAP().swap(thread_iterations[j]);
+        thread_events[j] = EventList();
+      }
+      return false;
+    }
+  return true;
+}
+
+// ends the metrics of the load with the merge of the thread results
+static void reportLoad(nanoseconds merge)
+{
+  LoadMetrics& metrics = LoadMetrics::last();
+  metrics.mergeMs = merge.count() / 1e6;
+  metrics.peakRssKB = LoadMetrics::peakRss();
+  // not with the results on cout
+  if (Log::enabled(LOG_INFO))
+    Log::write(*LoadMetrics::sink(), "loader metrics: " + metrics.json());
+}
+
+bool Simulation::parallelFileReading(string filename, double minLossToInclude, string mfid,
+                    bool ignoreOrdering, double fullRipScale)
+{
+  if (ignoreOrdering) {
+    shared_ptr<EventList> events = make_shared<EventList>();
+    if (!events->parallelFileReading(filename, minLossToInclude, mfid, fullRipScale))
+      return false;
+    clear();
+    _numIter = events->get_numIter();
+    riskGroupMap = events->riskGroupMap;
+    _flat = events;
+    // counted from the years if asked for
+    _counted.reset();
+    return true;
+  }
+
+  VLONG numIter;
+  if (!readInThreads(filename, minLossToInclude, mfid, false, fullRipScale, numIter))
+    return false;
+  _numIter = numIter;
+  TRACE_SCOPE("merge");
   high_resolution_clock::time_point _start = high_resolution_clock::now();
-  _iterations.swap(thread_iterations[0]);
+  // a fresh store, copies of the previous content keep theirs
+  _flat.reset();
+  _iterations = make_shared<VirtualYear::MAP>();
+  _factors.clear();
+  VirtualYear::MAP& iterations = *_iterations;
+  // the threads counted their events, the years split between two
+  //  threads are recounted once merged
+  _counts = Counts();
+  for (int i = 0; i < workers; i++) {
+    vector<VLONG>& counts = thread_counts[i];
+    if (counts.size() > _counts.byRiskGroup.size())
+      _counts.byRiskGroup.resize(counts.size(), 0);
+    for (size_t id = 0; id < counts.size(); id++) {
+      _counts.events += counts[id];
+      _counts.byRiskGroup[id] += counts[id];
+    }
+  }
+  _counted.reset();
+  _counted.set();
+  iterations.swap(thread_iterations[0]);
   riskGroupMap.swap(thread_riskGroupMap[0]);
   for (int i = 1; i < workers; i++) {
     for (VirtualYear::Iterator it = thread_iterations[i].begin(); it != thread_iterations[i].end(); it++)
     {
-      pair<VirtualYear::Iterator, bool> ret = _iterations.insert(VirtualYear::Pair(it->first, VirtualYear()));
-      if (!ret.second)
-        _iterations[it->first].addVirtualEvents(it->second);
+      pair<VirtualYear::Iterator, bool> ret = iterations.insert(VirtualYear::Pair(it->first, VirtualYear()));
+      if (!ret.second) {
+        _count(ret.first->second, -1);
+        _count(it->second, -1);
+        ret.first->second.addVirtualEvents(it->second);
+        _count(ret.first->second, 1);
+      }
       else
-        _iterations[it->first].swap(it->second);
+        ret.first->second.swap(it->second);
     }
     riskGroupMap.insert(thread_riskGroupMap[i].begin(), thread_riskGroupMap[i].end());
   }
-  nanoseconds ns = duration_cast<nanoseconds>(high_resolution_clock::now() - _start);
-  cerr << " merging years@ " << (ns.count() / 1000000) << " ms with " 
-       << riskGroupMap.size() << " risk groups" << endl;
+  reportLoad(duration_cast<nanoseconds>(high_resolution_clock::now() - _start));
+  return true;
+}
 
-  thread_input.close();
+bool EventList::parallelFileReading(string filename, double minLossToInclude, string mfid,
+                                    double fullRipScale)
+{
+  VLONG numIter;
+  if (!readInThreads(filename, minLossToInclude, mfid, true, fullRipScale, numIter))
+    return false;
+  TRACE_SCOPE("merge");
+  high_resolution_clock::time_point _start = high_resolution_clock::now();
+  *this = EventList();
+  _numIter = numIter;
+  for (int i = 0; i < workers; i++) {
+    append(thread_events[i]);
+    riskGroupMap.insert(thread_riskGroupMap[i].begin(), thread_riskGroupMap[i].end());
+  }
+  sort();
+  reportLoad(duration_cast<nanoseconds>(high_resolution_clock::now() - _start));
+  return true;
 }
 
-void Simulation::readFromFile(string simulationFile, double minLossToInclude, string mfid, 
+bool Simulation::readFromFile(string simulationFile, double minLossToInclude, string mfid, 
                               bool ignoreOrdering)
 {
   string inFileName = simulationFile.substr(0, simulationFile.length() - 4) + ".vsm";
-  cout << ToolBox::getAscTime() << "\t reading simulated data 1 from "
-       << simulationFile << ": >=" << minLossToInclude << endl;
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "\t reading simulated data 1 from "
+       << simulationFile << ": >=" << minLossToInclude);
 
   if (!ToolBox::fileExists(simulationFile)) {
     cerr << "Error 1: text file " + simulationFile + " not openable " + mfid << endl;
-    exit(0);
+    return false;
   }
-  parallelFileReading(simulationFile, minLossToInclude, mfid, ignoreOrdering, 0);
-  cout << ToolBox::getAscTime() << "-read " << countNumEvents() << " non-zero events" << endl;
+  if (!parallelFileReading(simulationFile, minLossToInclude, mfid, ignoreOrdering, 0))
+    return false;
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "-read "
+       << (_flat ? (VLONG)_flat->size() : countNumEvents()) << " non-zero events");
+  return true;
 }
 
-Simulation::Simulation(Simulation& original, string riskGroupToInclude, bool isInclude)
-  : _numIter(original.get_numIter())
+Simulation::Simulation(const Simulation& original, string riskGroupToInclude, bool isInclude)
+  : _iterations(make_shared<VirtualYear::MAP>()), _numIter(original.get_numIter())
 {
-  int nE = 0;
-  for(VirtualYear::Iterator iI = original._iterations.begin();
-    iI != original._iterations.end(); iI++)
-  {
-    const VirtualEvent::MAP & events = iI->second.get_events();
-    for(VirtualEvent::ConstIterator iE = events.begin(); iE != events.end(); iE++)
-    {
-      string rg = iE->second.riskGroup;
-      if (isInclude && rg == riskGroupToInclude || !isInclude && rg != riskGroupToInclude)
-      {
-        _iterations[iI->first].addVirtualEvent(iE->first, iE->second);
-        nE++;
-      }
-    }
-  }
-  cout << nE << " simulated losses passed filtering for RG " 
-       << riskGroupToInclude << endl; 
+  _counted.set();
+  *this += SimulationView(original, riskGroupToInclude, isInclude);
+  VCAPS_LOG(LOG_DEBUG, countNumEvents() << " simulated losses passed filtering for RG " 
+       << riskGroupToInclude);
+}
+
+Simulation::Simulation(const SimulationView& view)
+  : _iterations(make_shared<VirtualYear::MAP>()), _numIter(view.get_numIter())
+{
+  _counted.set();
+  *this += view;
 }
 
 void Simulation::operator*=(double factor)
 {
   if(fabs(factor-1) < 1e-5)
     return;
-  for(VirtualYear::Iterator iI = _iterations.begin(); iI != _iterations.end(); iI++)
-    iI->second *= factor;
+  _factors.scale(factor);
 }
 
-pair<double, double> Simulation::get_expected_sd(bool includeReinstatePrem)
+void Simulation::scale(double factor, string riskGroup)
 {
-  if(_numIter==0)
-    return pair<double, double>(0., 0.);
-  
-  double expectedLoss = 0, e2 = 0;
-  for(VirtualYear::Iterator iI = _iterations.begin(); iI != _iterations.end(); iI++) {
-    double annualLoss = iI->second.GetTotalLoss(includeReinstatePrem);
-    expectedLoss += annualLoss;
-    e2 += annualLoss*annualLoss;
+  if (riskGroup == "ALL")
+    *this *= factor;
+  else if (fabs(factor-1) >= 1e-5)
+    _factors.scale(factor, RiskGroupTable::intern(riskGroup));
+}
+
+void Simulation::materialize()
+{
+  // factors pending on single years are applied by the years themselves
+  //  when their events are accessed
+  if (_factors.identity())
+    return;
+
+  vector<VirtualYear*> years;
+  VirtualYear::MAP& iterations = _mutableIterations();
+  years.reserve(iterations.size());
+  for (VirtualYear::Iterator iI = iterations.begin(); iI != iterations.end(); iI++)
+    years.push_back(&iI->second);
+
+  long nYears = (long)years.size();
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (long i = 0; i < nYears; i++) {
+    VirtualEvent::MAP& events = years[i]->get_events();
+    for (VirtualEvent::Iterator iE = events.begin(); iE != events.end(); iE++)
+      _factors.apply(iE->second);
   }
+  _factors.clear();
+}
+
+void Simulation::freeze()
+{
+  materialize();
+  const VirtualYear::MAP& shared = _years();
+  vector<VirtualYear::ConstIterator> pending;
+  for (VirtualYear::ConstIterator iI = shared.begin(); iI != shared.end(); iI++)
+    if (iI->second.factor() != 1)
+      pending.push_back(iI);
+  if (pending.empty())
+    return;
+
+  VirtualYear::MAP& iterations = _mutableIterations();
+  vector<VirtualYear*> years;
+  for (size_t i = 0; i < pending.size(); i++)
+    years.push_back(&iterations[pending[i]->first]);
+  long nYears = (long)years.size();
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (long i = 0; i < nYears; i++)
+    years[i]->materialize();
+}
+
+bool Simulation::addVirtualEvent(VLONG iterId, int sequenceId, const VirtualEvent& e)
+{
+  materialize();
+  VirtualYear& year = _mutableIterations()[iterId];
+  int before = year.size();
+  if (!year.addVirtualEvent(sequenceId, e, 1.0, iterId))
+    return false;
+  _countAdded(year, before, e.rgId());
+  riskGroupMap[e.riskGroup()] = 1;
+  return true;
+}
+
+void Simulation::_collectYears(const VirtualYear::MAP& iterations,
+                               vector<VirtualYear::ConstIterator>& years)
+{
+  years.clear();
+  years.reserve(iterations.size());
+  for (VirtualYear::ConstIterator iI = iterations.begin(); iI != iterations.end(); iI++)
+    years.push_back(iI);
+}
 
-  expectedLoss /= (double)_numIter;
-  e2 /= (double)_numIter;
-
-  double sd = 0.0;
-  if(e2-expectedLoss*expectedLoss >= 0. )
-    sd = sqrt(e2 - expectedLoss*expectedLoss);
-  else {
-    cout<<"WARNNING: you get negative standard deviation: "<<endl
-      <<"\t e2 = "<<e2<<endl
-      <<"\t expectedLoss = "<<expectedLoss<<endl
-      <<"\t expectedLoss * expectedLoss = "<<expectedLoss * expectedLoss<<endl;  
+double Simulation::_annualLoss(const VirtualYear& year, const ScaleFactors& factors,
+                               bool includeReinstatePrem)
+{
+  if (factors.uniform())
+    return year.GetTotalLoss(includeReinstatePrem) * factors.all;
+
+  double totalLoss = 0.0;
+  const VirtualEvent::MAP& events = year.get_events();
+  for (VirtualEvent::ConstIterator iE = events.begin(); iE != events.end(); iE++) {
+    double loss = includeReinstatePrem ? iE->second.get_lossNetOfReinstatePrem() : iE->second.loss;
+    totalLoss += loss * factors.of(iE->second);
   }
+  return totalLoss * year.factor();
+}
 
-  return pair<double, double>(expectedLoss, sd);
+pair<double, double> Simulation::get_expected_sd(bool includeReinstatePrem) const
+{
+  TRACE_SCOPE("metrics");
+  if (_aggregateFlat()) {
+    EL_SD elsd = _flat->get_expected_sd(includeReinstatePrem);
+    return EL_SD(elsd.first * _factors.all, elsd.second * fabs(_factors.all));
+  }
+  const ScaleFactors& factors = _factors;
+  return _expected_sd(_years(), _numIter, [&factors, includeReinstatePrem](const VirtualYear& y) { 
+    return _annualLoss(y, factors, includeReinstatePrem); 
+  });
 }
 
-Simulation& Simulation::operator-=(const Simulation& newSimulation)
+void Simulation::aggregateByRiskGroup(map<string, AnnualLoss>& annualLosses,
+                                      bool includeReinstatePrem) const
 {
-  if(_numIter != newSimulation._numIter) {
-    if(_numIter == 0)
-      _numIter = newSimulation._numIter;
-    else if(!const_cast<Simulation&>(newSimulation).empty()) {
-      cerr << "Error: to add two Simulation objects _numIter must be the" << " same" << endl
-        << "But here are: " << _numIter << " and " << newSimulation._numIter << endl;
-      exit(0);
+  TRACE_SCOPE("aggregate");
+  if (_aggregateFlat()) {
+    _flat->aggregateByRiskGroup(annualLosses, includeReinstatePrem);
+    if (_factors.all != 1)
+      for (map<string, AnnualLoss>::iterator i = annualLosses.begin(); i != annualLosses.end(); i++)
+        i->second.scale(_factors.all);
+    return;
+  }
+  typedef vector< pair<VLONG, double> > ENTRIES; // (iterId, annual loss)
+
+  vector<VirtualYear::ConstIterator> years;
+  _collectYears(_years(), years);
+
+  long nYears = (long)years.size();
+  // [chunk][risk group id], each chunk is a contiguous range of years so
+  //  its entries are in iteration order. Fixed chunks, not one per
+  //  thread: the team may be smaller than omp_get_max_threads()
+  const long chunkYears = 4096;
+  long nChunks = (nYears + chunkYears - 1) / chunkYears;
+  vector< vector<ENTRIES> > partial(nChunks);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (long c = 0; c < nChunks; c++) {
+    vector<ENTRIES>& local = partial[c];
+    long end = (std::min)(nYears, (c + 1) * chunkYears);
+    for (long i = c * chunkYears; i < end; i++) {
+      VLONG iterId = years[i]->first;
+      double yearFactor = years[i]->second.factor();
+      const VirtualEvent::MAP& events = years[i]->second.get_events();
+      for (VirtualEvent::ConstIterator iE = events.begin(); iE != events.end(); iE++) {
+        const VirtualEvent& e = iE->second;
+        if (e.rgId() >= (int)local.size())
+          local.resize(e.rgId() + 1);
+        ENTRIES& entries = local[e.rgId()];
+        double loss = (includeReinstatePrem ? e.loss - e.reinstatementPrem : e.loss)
+                      * yearFactor * _factors.of(e.rgId());
+        if (entries.empty() || entries.back().first != iterId)
+          entries.push_back(pair<VLONG, double>(iterId, loss));
+        else
+          entries.back().second += loss;
+      }
     }
   }
 
-  VirtualYear::MAP& newIters = newSimulation.getIterations();
-  for(VirtualYear::Iterator iYear = newIters.begin(); iYear!= newIters.end(); iYear++) {
-    VirtualYear::Iterator i = _iterations.find(iYear->first);
-    if(i == _iterations.end())
-      _iterations[iYear->first] = - iYear->second;
-    else
-      i->second -= iYear->second;
+  int nGroups = 0;
+  for (long c = 0; c < nChunks; c++)
+    nGroups = (std::max)(nGroups, (int)partial[c].size());
+
+  vector<AnnualLoss> byId(nGroups, AnnualLoss(_numIter));
+  vector<char> seen(nGroups, 0);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int g = 0; g < nGroups; g++) {
+    AnnualLoss::MAP& losses = byId[g].get_annualLoss();
+    for (long c = 0; c < nChunks; c++) {
+      if (g >= (int)partial[c].size())
+        continue;
+      ENTRIES& entries = partial[c][g];
+      if (!entries.empty())
+        seen[g] = 1;
+      losses.insert(entries.begin(), entries.end());
+      ENTRIES().swap(entries);
+    }
   }
-  cout << " @@@@-= Now I have " << countNumEvents() << " events from gross " 
-       << const_cast<Simulation&>(newSimulation).countNumEvents() << endl;
-  return *this;
+
+  annualLosses.clear();
+  for (int g = 0; g < nGroups; g++)
+    if (seen[g])
+      annualLosses[RiskGroupTable::name(g)].swap(byId[g]);
 }
 
-Simulation& Simulation::operator+=(const Simulation& newSimulation)
+void Simulation::get_expected_sd(map<string, EL_SD>& elsd, bool includeReinstatePrem) const
+{
+  map<string, AnnualLoss> annualLosses;
+  aggregateByRiskGroup(annualLosses, includeReinstatePrem);
+  elsd.clear();
+  for (map<string, AnnualLoss>::iterator i = annualLosses.begin(); i != annualLosses.end(); i++)
+    elsd[i->first] = i->second.get_expected_sd();
+}
+
+bool Simulation::_matchNumIter(const Simulation& other, string& error)
 {
-  if(_numIter != newSimulation._numIter) {
+  if(_numIter != other._numIter) {
     if(_numIter == 0)
-      _numIter = newSimulation._numIter;
-    else if(!const_cast<Simulation&>(newSimulation).empty()) {
-      cerr << "Error: to add two Simulation objects _numIter must be the" << " same" << endl
-        << "But here are: " << _numIter << " and " << newSimulation._numIter << endl;
-      exit(0);
+      _numIter = other._numIter;
+    else if(!other.empty()) {
+      stringstream ss;
+      ss << "to add two Simulation objects _numIter must be the same, but here are: "
+         << _numIter << " and " << other._numIter;
+      error = ss.str();
+      return false;
     }
   }
+  return true;
+}
 
-  VirtualYear::MAP* newIters = const_cast<VirtualYear::MAP*>(&(newSimulation._iterations));
-  for (VirtualYear::Iterator iI = newIters->begin(); iI != newIters->end(); iI++) {
-    if (_iterations.find(iI->first) == _iterations.end())
-      _iterations[iI->first] = VirtualYear();
+VLONG Simulation::_combine(const YearPairs& years, const ScaleFactors& factors, double sign)
+{
+  bool counted = _counted.done();
+  long nYears = (long)years.size();
+  VLONG dropped = 0;
+#pragma omp parallel reduction(+:dropped)
+  {
+    Counts local;
+#pragma omp for schedule(dynamic, 1024) nowait
+    for (long i = 0; i < nYears; i++) {
+      VirtualYear& year = *years[i].first;
+      if (years[i].second) {
+        if (counted)
+          local.add(year, -1);
+        dropped += year.addScaled(*years[i].second, factors, sign);
+      }
+      if (counted)
+        local.add(year, 1);
+    }
+    if (counted) {
+#pragma omp critical
+      _counts.add(local);
+    }
   }
-  for (VirtualYear::Iterator iI = _iterations.begin(); iI != _iterations.end(); iI++) {
-    VirtualYear::Iterator iN = newIters->find(iI->first);
-    if (iN != newIters->end())
-      iI->second += iN->second;
+  return dropped;
+}
+
+VLONG Simulation::_combine(const Simulation& newSimulation, double sign)
+{
+  // hold the other store and copy its factors, it may be ours: the
+  //  detach below copies the store and materialize() clears the factors
+  shared_ptr<const VirtualYear::MAP> newStore = newSimulation.getStore();
+  const VirtualYear::MAP& newIters = *newStore;
+  ScaleFactors newFactors = newSimulation._factors;
+  materialize();
+  VirtualYear::MAP& iterations = _mutableIterations();
+  YearPairs years;
+  years.reserve(newIters.size());
+  for (VirtualYear::ConstIterator iN = newIters.begin(); iN != newIters.end(); iN++) {
+    VirtualYear& year = iterations[iN->first];
+    year.iterId = iN->first;
+    years.push_back(make_pair(&year, &iN->second));
+  }
+  return _combine(years, newFactors, sign);
+}
+
+VLONG Simulation::_combine(Simulation&& newSimulation, double sign)
+{
+  if (&newSimulation == this)
+    return _combine((const Simulation&)newSimulation, sign);
+  newSimulation._dropFlat();
+  // the years of a shared store are not ours to move
+  if (newSimulation._iterations.use_count() > 1) {
+    VLONG dropped = _combine((const Simulation&)newSimulation, sign);
+    newSimulation.clear();
+    return dropped;
   }
+
+  newSimulation.materialize();
+  VirtualYear::MAP& newIters = *newSimulation._iterations;
+  materialize();
+  VirtualYear::MAP& iterations = _mutableIterations();
+  YearPairs years;
+  years.reserve(newIters.size());
+  for (VirtualYear::Iterator iN = newIters.begin(); iN != newIters.end(); iN++) {
+    VirtualYear::Iterator iI = iterations.find(iN->first);
+    if (iI != iterations.end()) {
+      years.push_back(make_pair(&iI->second, &iN->second));
+      continue;
+    }
+    VirtualYear& year = iterations[iN->first];
+    year.swap(iN->second);
+    year.iterId = iN->first;
+    if (sign != 1.0)
+      year *= sign;
+    years.push_back(make_pair(&year, (const VirtualYear*)0));
+  }
+  VLONG dropped = _combine(years, ScaleFactors(), sign);
+  newSimulation.clear();
+  return dropped;
+}
+
+// false and the reason if a combine dropped events
+static bool noneDropped(VLONG dropped, string& error)
+{
+  if (dropped == 0)
+    return true;
+  stringstream ss;
+  ss << dropped << " events dropped for want of a free Noncat sequence id";
+  error = ss.str();
+  return false;
+}
+
+bool Simulation::subtract(const Simulation& newSimulation, string& error)
+{
+  if (!_matchNumIter(newSimulation, error))
+    return false;
+  VLONG dropped = _combine(newSimulation, -1.0);
+  VCAPS_LOG(LOG_DEBUG, " @@@@-= Now I have " << countNumEvents() << " events from gross " 
+       << newSimulation.countNumEvents());
+  return noneDropped(dropped, error);
+}
+
+bool Simulation::subtract(Simulation&& newSimulation, string& error)
+{
+  if (!_matchNumIter(newSimulation, error))
+    return false;
+  VLONG newEvents = Log::enabled(LOG_DEBUG) ? newSimulation.countNumEvents() : 0;
+  VLONG dropped = _combine(std::move(newSimulation), -1.0);
+  VCAPS_LOG(LOG_DEBUG, " @@@@-= Now I have " << countNumEvents() << " events from gross " 
+       << newEvents);
+  return noneDropped(dropped, error);
+}
+
+bool Simulation::add(const Simulation& newSimulation, string& error)
+{
+  if (!_matchNumIter(newSimulation, error))
+    return false;
   riskGroupMap.insert(newSimulation.riskGroupMap.begin(), newSimulation.riskGroupMap.end());
-  cout << " @@@@+= Now I have " << countNumEvents() << " events from gross "
-       << const_cast<Simulation&>(newSimulation).countNumEvents()
-       << " and " << riskGroupMap.size() << " riskGroups" <<  endl;
+  VLONG dropped = _combine(newSimulation, 1.0);
+  VCAPS_LOG(LOG_DEBUG, " @@@@+= Now I have " << countNumEvents() << " events from gross "
+       << newSimulation.countNumEvents()
+       << " and " << riskGroupMap.size() << " riskGroups");
+  return noneDropped(dropped, error);
+}
 
+bool Simulation::add(Simulation&& newSimulation, string& error)
+{
+  if (!_matchNumIter(newSimulation, error))
+    return false;
+  riskGroupMap.insert(newSimulation.riskGroupMap.begin(), newSimulation.riskGroupMap.end());
+  VLONG newEvents = Log::enabled(LOG_DEBUG) ? newSimulation.countNumEvents() : 0;
+  VLONG dropped = _combine(std::move(newSimulation), 1.0);
+  VCAPS_LOG(LOG_DEBUG, " @@@@+= Now I have " << countNumEvents() << " events from gross "
+       << newEvents << " and " << riskGroupMap.size() << " riskGroups");
+  return noneDropped(dropped, error);
+}
+
+Simulation& Simulation::operator-=(const Simulation& newSimulation)
+{
+  string error;
+  if (!subtract(newSimulation, error))
+    VCAPS_LOG(LOG_ERROR, "Error: -= " << error);
   return *this;
 }
 
-int Simulation::countNumEvents()
+Simulation& Simulation::operator-=(Simulation&& newSimulation)
+{
+  string error;
+  if (!subtract(std::move(newSimulation), error))
+    VCAPS_LOG(LOG_ERROR, "Error: -= " << error);
+  return *this;
+}
+
+Simulation& Simulation::operator+=(const Simulation& newSimulation)
+{
+  string error;
+  if (!add(newSimulation, error))
+    VCAPS_LOG(LOG_ERROR, "Error: += " << error);
+  return *this;
+}
+
+Simulation& Simulation::operator+=(Simulation&& newSimulation)
+{
+  string error;
+  if (!add(std::move(newSimulation), error))
+    VCAPS_LOG(LOG_ERROR, "Error: += " << error);
+  return *this;
+}
+
+Simulation& Simulation::operator+=(const SimulationView& view)
+{
+  TRACE_SCOPE("filter");
+  if(_numIter == 0)
+    _numIter = view.get_numIter();
+
+  // the view keeps its store alive even if it is ours and gets copied
+  const VirtualYear::MAP& viewIters = view.getIterations();
+  materialize();
+  VirtualYear::MAP& iterations = _mutableIterations();
+  // the risk groups added, by RiskGroupTable id: riskGroupMap is filled
+  //  once at the end, not looked up by name per event
+  vector<char> added;
+  for (VirtualYear::ConstIterator iI = viewIters.begin(); iI != viewIters.end(); iI++) {
+    const VirtualEvent::MAP& events = iI->second.get_events();
+    VirtualYear* year = 0;
+    for (VirtualEvent::ConstIterator iE = events.begin(); iE != events.end(); iE++) {
+      if (!view.accepts(iE->second))
+        continue;
+      if (!year)
+        year = &iterations[iI->first];
+      int before = year->size();
+      int rgId = iE->second.rgId();
+      year->addVirtualEvent(iE->first, iE->second, view.factorOf(iI->second, iE->second), iI->first);
+      _countAdded(*year, before, rgId);
+      if (rgId >= (int)added.size())
+        added.resize(rgId + 1, 0);
+      added[rgId] = 1;
+    }
+  }
+  for (int g = 0; g < (int)added.size(); g++)
+    if (added[g])
+      riskGroupMap[RiskGroupTable::name(g)] = 1;
+  return *this;
+}
+
+void Simulation::_buildCounts() const
+{
+  vector<VirtualYear::ConstIterator> years;
+  _collectYears(_years(), years);
+
+  Counts counts;
+  long nYears = (long)years.size();
+#pragma omp parallel
+  {
+    Counts local;
+#pragma omp for schedule(dynamic, 1024) nowait
+    for (long i = 0; i < nYears; i++)
+      local.add(years[i]->second, 1);
+#pragma omp critical
+    counts.add(local);
+  }
+  _counts.events = counts.events;
+  _counts.byRiskGroup.swap(counts.byRiskGroup);
+}
+
+void Simulation::Counts::add(const VirtualYear& year, int sign)
+{
+  const VirtualEvent::MAP& yearEvents = year.get_events();
+  events += sign * (VLONG)yearEvents.size();
+  for (VirtualEvent::ConstIterator iE = yearEvents.begin(); iE != yearEvents.end(); iE++) {
+    int rgId = iE->second.rgId();
+    if (rgId >= (int)byRiskGroup.size())
+      byRiskGroup.resize(rgId + 1, 0);
+    byRiskGroup[rgId] += sign;
+  }
+}
+
+void Simulation::Counts::add(const Counts& other)
+{
+  events += other.events;
+  if (other.byRiskGroup.size() > byRiskGroup.size())
+    byRiskGroup.resize(other.byRiskGroup.size(), 0);
+  for (size_t id = 0; id < other.byRiskGroup.size(); id++)
+    byRiskGroup[id] += other.byRiskGroup[id];
+}
+
+void Simulation::_count(const VirtualYear& year, int sign)
+{
+  if (_counted.done())
+    _counts.add(year, sign);
+}
+
+VLONG Simulation::countNumEvents() const
+{
+  _counted.call([this]() { _buildCounts(); });
+  return _counts.events;
+}
+
+VLONG Simulation::countNumEvents(const string& riskGroup) const
+{
+  _counted.call([this]() { _buildCounts(); });
+  int rgId = RiskGroupTable::intern(riskGroup);
+  return rgId < (int)_counts.byRiskGroup.size() ? _counts.byRiskGroup[rgId] : 0;
+}
+
+bool Simulation::empty() const
+{
+  return _flat ? _flat->empty() : _iterations->size() == 0;
+}
+
+void Simulation::_expand() const
 {
-  int nTotalEvent = 0;
-  for (VirtualYear::Iterator iI = _iterations.begin(); iI != _iterations.end(); ++iI)
-    nTotalEvent += iI->second.size();
-  return nTotalEvent;
+  Simulation years = _flat->toSimulation();
+  _iterations = years._iterations;
 }
 
 void Simulation::clear()
 {
-  _iterations.clear();
+  _flat.reset();
+  _iterations = make_shared<VirtualYear::MAP>();
+  _factors.clear();
   _numIter = 0;
+  _counts = Counts();
+  _counted.reset();
+  _counted.set();
 }
 
 
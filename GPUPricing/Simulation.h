@@ -2,6 +2,7 @@
 
 #include <map>
 #include <string>
+#include <memory>
 #include <sys/stat.h>
 
 #ifdef _WINDOWS
@@ -10,6 +11,8 @@
 #include <sys/time.h>
 #endif
 #include "virtualYear.h"
+#include "AnnualLoss.h"
+#include "Reduction.h"
 
 using namespace std;
 
@@ -51,77 +54,303 @@ public:
 
 typedef pair<double, double> EL_SD;
 
+class SimulationView;
+class EventList;
+
+/*
+  The years are held in a reference counted store shared by copies of a
+  Simulation: copying is O(1) and the store is only duplicated when a
+  Simulation sharing it is about to be modified (copy-on-write). Readers
+  should go through the const accessors so they never trigger a copy.
+  The const members never modify anything: many threads can query one
+  Simulation (or copies of it) through a const reference, as long as no
+  thread calls a non-const member on that object meanwhile. freeze()
+  applies everything deferred beforehand, so the queries read plain data.
+
+  A simulation read ignoring the ordering keeps the flat EventList it was
+  read into: the aggregates run on it, and the one-year-per-event store
+  is only built for the members that need the years
+*/
 class Simulation
 {
 public:
   typedef map<string, Simulation*> MAP;
   typedef map<string, int> RGMAP;
+  typedef shared_ptr<VirtualYear::MAP> STORE;
 
 public:
-  Simulation() : _numIter(0)
-  {}
+  Simulation() : _iterations(make_shared<VirtualYear::MAP>()), _numIter(0)
+  { _counted.set(); }
 
   Simulation(const Simulation& newSimu)
-    : _numIter(newSimu._numIter), _iterations(newSimu._iterations), riskGroupMap(newSimu.riskGroupMap)
-  {}
+    : riskGroupMap(newSimu.riskGroupMap), _factors(newSimu._factors), _numIter(newSimu._numIter)
+  { _copyYears(newSimu); _copyCounts(newSimu); }
 
-  Simulation(Simulation& original, string riskGroupToInclude, bool isInclude);
+  Simulation(const Simulation& original, string riskGroupToInclude, bool isInclude);
+  Simulation(const SimulationView& view);
 
-  ~Simulation() { clear(); }
+  ~Simulation() {}
 
+  // applies the pending factors, copying the store first if it is shared.
+  //  The caller may change the events: the counts are rebuilt on next use
   VirtualYear::MAP & getIterations()
-  { return _iterations; }
+  { materialize(); _counted.reset(); return _mutableIterations(); }
+
+  // the events before get_factors() are applied
+  const VirtualYear::MAP & getIterations() const
+  { return _years(); }
 
-  VirtualYear::MAP & getIterations() const
-  { return const_cast<VirtualYear::MAP&>(_iterations); }
+  // the shared store, for readers that must outlive this Simulation
+  shared_ptr<const VirtualYear::MAP> getStore() const { _years(); return _iterations; }
 
-  Simulation(int numIter);
+  Simulation(VLONG numIter);
   
   void operator=(const Simulation& newSimu) { 
     _numIter = newSimu._numIter;
-    _iterations = newSimu._iterations;
+    _copyYears(newSimu);
+    _factors = newSimu._factors;
     riskGroupMap= newSimu.riskGroupMap;
+    _copyCounts(newSimu);
   }
-  void operator=(VirtualYear::MAP& ymap) {_iterations.swap(ymap);}
-  VirtualYear& operator[](int iterId) { return _iterations[iterId]; }
+  void operator=(VirtualYear::MAP& ymap) {
+    _flat.reset();
+    _iterations = make_shared<VirtualYear::MAP>();
+    _iterations->swap(ymap);
+    _factors.clear();
+    _counted.reset();
+  }
+  VirtualYear& operator[](VLONG iterId)
+  { materialize(); _counted.reset(); return _mutableIterations()[iterId]; }
+
+  // false if e could not be added, see VirtualYear::addVirtualEvent
+  bool addVirtualEvent(VLONG iterId, int sequenceId, const VirtualEvent& e);
 
+  /*
+    scaling is deferred: the factors are recorded in O(1) and applied by
+    the aggregates when they read the events, or by materialize()
+  */
   void operator*=(double factor); // For rg="ALL"
-  void parallelFileReading(string filename, double minLossToInclude, string mfid, 
+  void scale(double factor, string riskGroup);
+  const ScaleFactors& get_factors() const { return _factors; }
+  void materialize();
+  // materialize() including the factors pending on single years
+  void freeze();
+
+  // false, the reason on cerr, if the file is missing or malformed; the
+  //  simulation is then left as it was
+  bool parallelFileReading(string filename, double minLossToInclude, string mfid, 
             bool ignoreOrdering, double fullRipScale);
-  void readFromFile(string simulationFileName, double minLossToInclude, string mfid, 
+  bool readFromFile(string simulationFileName, double minLossToInclude, string mfid, 
             bool ignoreOrdering=false);
-  void set_numIter(int numIter){_numIter = numIter; }
-  int get_numIter() const { return _numIter; }
-  bool empty() { return _iterations.size()==0; }
+  void set_numIter(VLONG numIter){_numIter = numIter; }
+  VLONG get_numIter() const { return _numIter; }
+  bool empty() const;
+
+  /*
+    O(1) once counted: the counts are built by the first query, then kept
+    up to date by the members that add, merge or filter events
+  */
+  VLONG countNumEvents() const;
+  VLONG countNumEvents(const string& riskGroup) const;
+  VLONG countNumYears() const { return (VLONG)_years().size(); }
 
-  int countNumEvents();
+  pair<double, double> get_expected_sd(bool includeReinstatePrem=1) const;
 
-  pair<double, double> get_expected_sd(bool includeReinstatePrem=1);
+  /*
+    per risk group annual losses (key = risk group name) built in one
+    parallel scan, instead of one filtered copy of the simulation per group
+  */
+  void aggregateByRiskGroup(map<string, AnnualLoss>& annualLosses,
+                            bool includeReinstatePrem=1) const;
+  void get_expected_sd(map<string, EL_SD>& elsd, bool includeReinstatePrem=1) const;
 
+  /*
+    the years of both sides are combined in parallel. The rvalue overloads
+    move the years newSimulation has and this one has not instead of
+    copying them, and leave newSimulation cleared
+  */
   Simulation& operator+=(const Simulation& newSimulation);
-  inline Simulation operator+(const Simulation& newSimulation) {
-    Simulation lhs;
+  Simulation& operator+=(Simulation&& newSimulation);
+  Simulation& operator+=(const SimulationView& view);
+  inline Simulation operator+(const Simulation& newSimulation) const {
+    Simulation lhs(*this);
     lhs += newSimulation;
     return lhs;
   }
   Simulation& operator-=(const Simulation& newSimulation);
+  Simulation& operator-=(Simulation&& newSimulation);
+  /*
+    += and -= that fail instead: false and the reason if the iteration
+    counts differ (nothing is added then) or if events of newSimulation
+    were not added for want of a free Noncat sequence id (see
+    VirtualYear::addVirtualEvent). The operators only log the error
+  */
+  bool add(const Simulation& newSimulation, string& error);
+  bool add(Simulation&& newSimulation, string& error);
+  bool subtract(const Simulation& newSimulation, string& error);
+  bool subtract(Simulation&& newSimulation, string& error);
 
   void clear();
 
   void swap(Simulation& other) {
     (std::swap)(_numIter, other._numIter);
     _iterations.swap(other._iterations);
+    _flat.swap(other._flat);
+    (std::swap)(_factors, other._factors);
+    (std::swap)(_counts, other._counts);
+    _swapFlags(_counted, other._counted);
+    _swapFlags(_expanded, other._expanded);
   }
 public:
   RGMAP riskGroupMap;
 
 private:
+  friend class SimulationView;
+
+  // the years, built from the flat rows on first use
+  const VirtualYear::MAP& _years() const {
+    if (_flat)
+      _expanded.call([this]() { _expand(); });
+    return *_iterations;
+  }
+  void _expand() const;
+  // the flat rows stand for the years, and no pending factor but a
+  //  uniform one applies: the aggregates can run on them
+  bool _aggregateFlat() const {
+    return _flat && !_expanded.done() && _factors.uniform();
+  }
+  // before the years get modified
+  void _dropFlat() {
+    if (_flat) {
+      _years();
+      _flat.reset();
+    }
+  }
+  void _copyYears(const Simulation& other) {
+    if (&other == this)
+      return;
+    _flat = other._flat;
+    _expanded.reset();
+    // do not read the store of other while it may be being expanded
+    if (_flat && !other._expanded.done())
+      _iterations = make_shared<VirtualYear::MAP>();
+    else {
+      _iterations = other._iterations;
+      if (_flat)
+        _expanded.set();
+    }
+  }
+  static void _swapFlags(OnceFlag& a, OnceFlag& b) {
+    bool aDone = a.done(), bDone = b.done();
+    a.reset();
+    b.reset();
+    if (bDone) a.set();
+    if (aDone) b.set();
+  }
+
+  VirtualYear::MAP & _mutableIterations() {
+    _dropFlat();
+    if (_iterations.use_count() > 1)
+      _iterations = make_shared<VirtualYear::MAP>(*_iterations);
+    return *_iterations;
+  }
+
+  // the years in iteration order, for parallel passes
+  static void _collectYears(const VirtualYear::MAP& iterations,
+                            vector<VirtualYear::ConstIterator>& years);
+
+  // annual loss of a year with the year's and the given pending factors
+  static double _annualLoss(const VirtualYear& year, const ScaleFactors& factors,
+                            bool includeReinstatePrem);
+
+  // number of events, in all and per RiskGroupTable id
+  struct Counts {
+    VLONG events;
+    vector<VLONG> byRiskGroup;
+    Counts() : events(0) {}
+
+    // adds sign * the events of year
+    void add(const VirtualYear& year, int sign);
+    void add(const Counts& other);
+  };
+
+  void _buildCounts() const;
+  // adds sign * the events of year to the counts, if they are built
+  void _count(const VirtualYear& year, int sign);
+  // after VirtualYear::addVirtualEvent of an event of rgId on a year
+  //  that had sizeBefore events
+  void _countAdded(const VirtualYear& year, int sizeBefore, int rgId) {
+    if (year.size() > sizeBefore && _counted.done()) {
+      _counts.events++;
+      if (rgId >= (int)_counts.byRiskGroup.size())
+        _counts.byRiskGroup.resize(rgId + 1, 0);
+      _counts.byRiskGroup[rgId]++;
+    }
+  }
+  // false and the reason if the iteration counts of this and other differ
+  bool _matchNumIter(const Simulation& other, string& error);
+  // a year of this and the year of the other simulation added to it, 0
+  //  if the year was moved from there already
+  typedef vector< pair<VirtualYear*, const VirtualYear*> > YearPairs;
+  // adds sign * the other years, scaled by factors, in parallel
+  // the number of events not added
+  VLONG _combine(const YearPairs& years, const ScaleFactors& factors, double sign);
+  VLONG _combine(const Simulation& newSimulation, double sign);
+  VLONG _combine(Simulation&& newSimulation, double sign);
+
+  void _copyCounts(const Simulation& other) {
+    if (&other == this)
+      return;
+    _counted.reset();
+    if (other._counted.done()) {
+      _counts = other._counts;
+      _counted.set();
+    }
+  }
+
+  // EL and SD of the annual losses given by annualLossOf(const VirtualYear&)
+  template<class AnnualLossOf>
+  static EL_SD _expected_sd(const VirtualYear::MAP& iterations, VLONG numIter,
+                            AnnualLossOf annualLossOf);
+
   // key = iteration ID
   //  only include the iterations with losses
-  VirtualYear::MAP _iterations;
+  mutable STORE _iterations;
+  // the rows of a simulation read ignoring the ordering, the years are
+  //  built from them by _years()
+  shared_ptr<const EventList> _flat;
+  mutable OnceFlag _expanded;
+
+  // pending factors, not applied to the store yet
+  ScaleFactors _factors;
 
   // number of iterations including those with no losses
-  int _numIter;
+  VLONG _numIter;
+
+  mutable Counts _counts;
+  mutable OnceFlag _counted;
 };
 
+template<class AnnualLossOf>
+EL_SD Simulation::_expected_sd(const VirtualYear::MAP& iterations, VLONG numIter,
+                               AnnualLossOf annualLossOf)
+{
+  if(numIter==0)
+    return EL_SD(0., 0.);
+
+  vector<VirtualYear::ConstIterator> years;
+  _collectYears(iterations, years);
+
+  long nYears = (long)years.size();
+  vector<double> annualLosses(nYears);
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (long i = 0; i < nYears; i++)
+    annualLosses[i] = annualLossOf(years[i]->second);
+
+  Moments m = Reduction::moments(annualLosses);
+  m.normalize((double)numIter);
+
+  return EL_SD(m.mean, sqrt(m.variance()));
+}
+
 }
\ No newline at end of file
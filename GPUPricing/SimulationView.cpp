@@ -0,0 +1,55 @@
+#include "SimulationView.h"
+
+namespace VCAPS
+{
+
+SimulationView::SimulationView(const Simulation& original, string riskGroup, bool isInclude)
+  : _iterations(original.getStore()), _factors(original.get_factors()), 
+    _numIter(original.get_numIter()), _isInclude(isInclude)
+{
+  _setMask(vector<string>(1, riskGroup));
+}
+
+SimulationView::SimulationView(const Simulation& original, const vector<string>& riskGroups, 
+                               bool isInclude)
+  : _iterations(original.getStore()), _factors(original.get_factors()), 
+    _numIter(original.get_numIter()), _isInclude(isInclude)
+{
+  _setMask(riskGroups);
+}
+
+void SimulationView::_setMask(const vector<string>& riskGroups)
+{
+  vector<int> ids;
+  for (size_t i = 0; i < riskGroups.size(); i++)
+    ids.push_back(RiskGroupTable::intern(riskGroups[i]));
+
+  // ids interned later are never in riskGroups, accepts() handles them
+  _mask.assign(RiskGroupTable::size(), _isInclude ? 0 : 1);
+  for (size_t i = 0; i < ids.size(); i++)
+    _mask[ids[i]] = _isInclude ? 1 : 0;
+}
+
+double SimulationView::GetTotalLoss(const VirtualYear& year, bool includeReinstatePrem) const
+{
+  double totalLoss = 0.0;
+  const VirtualEvent::MAP& events = year.get_events();
+  for (VirtualEvent::ConstIterator iE = events.begin(); iE != events.end(); iE++) {
+    if (!accepts(iE->second))
+      continue;
+    double loss = includeReinstatePrem ? iE->second.get_lossNetOfReinstatePrem() : iE->second.loss;
+    totalLoss += loss * _factors.of(iE->second);
+  }
+  return totalLoss * year.factor();
+}
+
+pair<double, double> SimulationView::get_expected_sd(bool includeReinstatePrem) const
+{
+  const SimulationView& view = *this;
+  return Simulation::_expected_sd(*_iterations, _numIter, 
+                                  [&view, includeReinstatePrem](const VirtualYear& y) {
+    return view.GetTotalLoss(y, includeReinstatePrem);
+  });
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Simulation.h"
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  filtered view of a Simulation by risk group. It shares the (immutable)
+  store of the original and keeps a per-risk-group accept mask (indexed
+  by RiskGroupTable id), so include/exclude filtering costs an array
+  lookup per event and no copy of the years. Later changes to the
+  original detach it from the store and are not seen by the view
+*/
+class SimulationView
+{
+public:
+  SimulationView(const Simulation& original, string riskGroup, bool isInclude);
+  SimulationView(const Simulation& original, const vector<string>& riskGroups, bool isInclude);
+
+  bool accepts(const VirtualEvent& e) const {
+    return e.rgId() < (int)_mask.size() ? _mask[e.rgId()] != 0 : !_isInclude;
+  }
+
+  VLONG get_numIter() const { return _numIter; }
+
+  // pending factor of the original for an event of the given year
+  double factorOf(const VirtualYear& year, const VirtualEvent& e) const {
+    return year.factor() * _factors.of(e);
+  }
+
+  // the raw store of the original, unfiltered and without the factors:
+  //  callers must skip the events accepts() rejects and apply factorOf(),
+  //  or use forEachEvent, which does both
+  const VirtualYear::MAP & getIterations() const { return *_iterations; }
+
+  // f(iterId, sequenceId, event) for every accepted event, factors applied
+  template<class F>
+  void forEachEvent(F f) const;
+
+  double GetTotalLoss(const VirtualYear& year, bool includeReinstatePrem) const;
+  pair<double, double> get_expected_sd(bool includeReinstatePrem=1) const;
+
+private:
+  void _setMask(const vector<string>& riskGroups);
+
+  shared_ptr<const VirtualYear::MAP> _iterations;
+  ScaleFactors _factors;
+  VLONG _numIter;
+  bool _isInclude;
+  vector<char> _mask;
+};
+
+template<class F>
+void SimulationView::forEachEvent(F f) const
+{
+  const VirtualYear::MAP& iters = *_iterations;
+  for (VirtualYear::ConstIterator iI = iters.begin(); iI != iters.end(); iI++) {
+    const VirtualEvent::MAP& events = iI->second.get_events();
+    for (VirtualEvent::ConstIterator iE = events.begin(); iE != events.end(); iE++) {
+      if (!accepts(iE->second))
+        continue;
+      double factor = factorOf(iI->second, iE->second);
+      if (factor == 1)
+        f(iI->first, iE->first, iE->second);
+      else {
+        VirtualEvent scaled = iE->second;
+        scaled *= factor;
+        f(iI->first, iE->first, (const VirtualEvent&)scaled);
+      }
+    }
+  }
+}
+
+}
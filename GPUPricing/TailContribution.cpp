@@ -0,0 +1,162 @@
+#include "TailContribution.h"
+
+#include <algorithm>
+#include <climits>
+#include <omp.h>
+
+#include "Trace.h"
+
+namespace VCAPS
+{
+
+/*
+  the losses of an event or a risk group per band of ranks: band b holds
+  the tail years ranked in [bounds[b-1], bounds[b]), so the tail of a
+  prob whose tail size is bounds[b] is made of the bands 0..b
+*/
+struct BandSums
+{
+  vector<double> bands;
+  int first; // the first band it occurs in
+
+  BandSums() : first(INT_MAX) {}
+
+  void add(int band, int nBands, double loss) {
+    if (bands.empty())
+      bands.assign(nBands, 0.);
+    bands[band] += loss;
+    first = (std::min)(first, band);
+  }
+
+  void add(const BandSums& other) {
+    if (other.bands.empty())
+      return;
+    if (bands.empty())
+      bands.assign(other.bands.size(), 0.);
+    for (size_t b = 0; b < bands.size(); b++)
+      bands[b] += other.bands[b];
+    first = (std::min)(first, other.first);
+  }
+
+  // the sum over the bands 0..band, false if it does not occur there
+  bool sum(int band, double& total) const {
+    if (first > band)
+      return false;
+    total = 0;
+    for (int b = 0; b <= band; b++)
+      total += bands[b];
+    return true;
+  }
+};
+
+vector<TailContributionEngine::Result>
+TailContributionEngine::compute(const Simulation& sim, const vector<double>& probs,
+                                bool includeReinstatePrem)
+{
+  TRACE_SCOPE("tail contributions");
+  vector<Result> results(probs.size());
+  for (size_t j = 0; j < probs.size(); j++)
+    results[j].prob = probs[j];
+  VLONG numIter = sim.get_numIter();
+  if (numIter == 0 || probs.empty())
+    return results;
+
+  const VirtualYear::MAP& iterations = sim.getIterations();
+  const ScaleFactors& factors = sim.get_factors();
+  vector<const VirtualYear*> years;
+  years.reserve(iterations.size());
+  for (VirtualYear::ConstIterator iI = iterations.begin(); iI != iterations.end(); iI++)
+    years.push_back(&iI->second);
+
+  // the years by decreasing annual loss, ties in iteration order, as
+  //  AnnualLoss ranks them
+  long nYears = (long)years.size();
+  vector< pair<double, long> > sorted(nYears);
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (long y = 0; y < nYears; y++) {
+    double annualLoss = 0;
+    const VirtualEvent::MAP& events = years[y]->get_events();
+    for (VirtualEvent::ConstIterator iE = events.begin(); iE != events.end(); iE++) {
+      double loss = includeReinstatePrem ? iE->second.get_lossNetOfReinstatePrem() : iE->second.loss;
+      annualLoss += loss * factors.of(iE->second);
+    }
+    sorted[y] = pair<double, long>(-annualLoss * years[y]->factor(), y);
+  }
+  sort(sorted.begin(), sorted.end());
+
+  // the tail of each prob, as in AnnualLoss::getTVaR: the years without
+  //  loss are zeros between the positive and the negative losses
+  VLONG positive = lower_bound(sorted.begin(), sorted.end(), pair<double, long>(0., LONG_MIN))
+                   - sorted.begin();
+  VLONG zeros = (std::max)((VLONG)0, numIter - nYears);
+  vector<long> tails(probs.size());
+  for (size_t j = 0; j < probs.size(); j++) {
+    VLONG n = (std::max)((VLONG)1, (VLONG)(numIter * probs[j] + 0.5));
+    VLONG k = n <= positive ? n : (std::max)(positive, n - zeros);
+    tails[j] = (long)(std::min)(k, (VLONG)nYears);
+    results[j].tailYears = n;
+  }
+  vector<long> bounds(tails);
+  sort(bounds.begin(), bounds.end());
+  bounds.erase(unique(bounds.begin(), bounds.end()), bounds.end());
+  if (!bounds.empty() && bounds[0] == 0)
+    bounds.erase(bounds.begin());
+  int nBands = (int)bounds.size();
+  long nTail = nBands > 0 ? bounds.back() : 0;
+
+  unordered_map<int, BandSums> byEvent;
+  vector<BandSums> byRiskGroup;
+#pragma omp parallel
+  {
+    unordered_map<int, BandSums> localEvents;
+    vector<BandSums> localGroups;
+#pragma omp for schedule(dynamic, 64) nowait
+    for (long r = 0; r < nTail; r++) {
+      const VirtualYear& year = *years[sorted[r].second];
+      int band = (int)(upper_bound(bounds.begin(), bounds.end(), r) - bounds.begin());
+      const VirtualEvent::MAP& events = year.get_events();
+      for (VirtualEvent::ConstIterator iE = events.begin(); iE != events.end(); iE++) {
+        const VirtualEvent& e = iE->second;
+        double loss = (includeReinstatePrem ? e.get_lossNetOfReinstatePrem() : e.loss)
+                      * factors.of(e) * year.factor();
+        localEvents[e.eventId()].add(band, nBands, loss);
+        int rgId = e.rgId();
+        if (rgId >= (int)localGroups.size())
+          localGroups.resize(rgId + 1);
+        localGroups[rgId].add(band, nBands, loss);
+      }
+    }
+#pragma omp critical
+    {
+      for (unordered_map<int, BandSums>::iterator i = localEvents.begin(); i != localEvents.end(); i++)
+        byEvent[i->first].add(i->second);
+      if (localGroups.size() > byRiskGroup.size())
+        byRiskGroup.resize(localGroups.size());
+      for (size_t g = 0; g < localGroups.size(); g++)
+        byRiskGroup[g].add(localGroups[g]);
+    }
+  }
+
+  for (size_t j = 0; j < probs.size(); j++) {
+    Result& result = results[j];
+    double n = (double)result.tailYears;
+    double tailLoss = 0;
+    for (long r = 0; r < tails[j]; r++)
+      tailLoss -= sorted[r].first;
+    result.tvar = tailLoss / n;
+    if (tails[j] == 0)
+      continue;
+
+    int band = (int)(lower_bound(bounds.begin(), bounds.end(), tails[j]) - bounds.begin());
+    double total;
+    for (unordered_map<int, BandSums>::const_iterator i = byEvent.begin(); i != byEvent.end(); i++)
+      if (i->second.sum(band, total))
+        result.byEvent[i->first] = total / n;
+    for (size_t g = 0; g < byRiskGroup.size(); g++)
+      if (byRiskGroup[g].sum(band, total))
+        result.byRiskGroup[RiskGroupTable::name((int)g)] = total / n;
+  }
+  return results;
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "Simulation.h"
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  co-TVaR of the events and risk groups of a Simulation: which events
+  drive the tail. The TVaR at prob is the mean of the annual losses of the
+  n tail years, n and the tail as in AnnualLoss::getTVaR, and the
+  contribution of an event is the sum of its losses in those years / n,
+  so the contributions add up to the TVaR. The years are ranked once, and
+  one parallel scan of the tail years of the largest prob accumulates the
+  contributions at every prob
+*/
+class TailContributionEngine
+{
+public:
+  struct Result
+  {
+    double prob;
+    double tvar;
+    VLONG tailYears; // n
+    // key = event ID, only the events occurring in the tail
+    unordered_map<int, double> byEvent;
+    // key = risk group name, only the groups occurring in the tail
+    map<string, double> byRiskGroup;
+
+    Result() : prob(0), tvar(0), tailYears(0) {}
+  };
+
+  // one result per prob, in the order of probs (exceedance probabilities,
+  //  0.004 for 1 in 250 years)
+  static vector<Result> compute(const Simulation& sim, const vector<double>& probs,
+                                bool includeReinstatePrem=1);
+};
+
+}
@@ -0,0 +1,161 @@
+#include "Trace.h"
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace chrono;
+
+namespace VCAPS
+{
+
+// atomic fields so write() may read a span being overwritten, and tell
+//  by the count that it was
+struct Span
+{
+  atomic<const char*> name;
+  atomic<long long> begin, end;
+};
+
+// written by the thread holding it only, read by write()
+struct TraceBuffer
+{
+  TraceBuffer(int t) : tid(t), spans(new Span[Trace::bufferSize]), count(0) {}
+
+  int tid;
+  unique_ptr<Span[]> spans;
+  atomic<size_t> count;
+};
+
+// the buffers outlive their threads, so the spans of the loader threads
+//  are still there at exit; the free ones are reused by the new threads
+static mutex buffersMutex;
+static vector<TraceBuffer*> buffers;
+static vector<TraceBuffer*> freeBuffers;
+static string traceFile;
+static steady_clock::time_point origin;
+
+// the buffer of a thread, given back when it exits
+struct BufferHolder
+{
+  TraceBuffer* buffer;
+  bool full; // no buffer was left
+
+  BufferHolder() : buffer(0), full(false) {}
+  ~BufferHolder() {
+    if (!buffer)
+      return;
+    lock_guard<mutex> lck(buffersMutex);
+    freeBuffers.push_back(buffer);
+  }
+};
+
+static void writeAtExit()
+{
+  Trace::write();
+}
+
+void Trace::start(const string& fileName)
+{
+  {
+    lock_guard<mutex> lck(buffersMutex);
+    bool first = traceFile.empty();
+    traceFile = fileName;
+    if (!first)
+      return;
+    origin = steady_clock::now();
+  }
+  atexit(writeAtExit);
+  _enabled().store(true);
+}
+
+long long Trace::now()
+{
+  return duration_cast<nanoseconds>(steady_clock::now() - origin).count();
+}
+
+void Trace::record(const char* name, long long begin, long long end)
+{
+  static thread_local BufferHolder local;
+  if (!local.buffer) {
+    if (local.full)
+      return;
+    lock_guard<mutex> lck(buffersMutex);
+    if (!freeBuffers.empty()) {
+      local.buffer = freeBuffers.back();
+      freeBuffers.pop_back();
+    }
+    else if (buffers.size() < maxBuffers) {
+      local.buffer = new TraceBuffer((int)buffers.size());
+      buffers.push_back(local.buffer);
+    }
+    else {
+      local.full = true;
+      return;
+    }
+  }
+  TraceBuffer& buffer = *local.buffer;
+  size_t n = buffer.count.load(memory_order_relaxed);
+  // a write() that sees this span sees the count of n at least
+  atomic_thread_fence(memory_order_release);
+  Span& span = buffer.spans[n % bufferSize];
+  span.name.store(name, memory_order_relaxed);
+  span.begin.store(begin, memory_order_relaxed);
+  span.end.store(end, memory_order_relaxed);
+  buffer.count.store(n + 1, memory_order_release);
+}
+
+bool Trace::write()
+{
+  lock_guard<mutex> lck(buffersMutex);
+  if (traceFile.empty())
+    return false;
+  ofstream out(traceFile.c_str());
+  if (!out) {
+    cerr << "Error: can not write the trace " << traceFile << endl;
+    return false;
+  }
+
+  int pid = (int)getpid();
+  out << fixed;
+  out.precision(3);
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  bool first = true;
+  for (size_t b = 0; b < buffers.size(); b++) {
+    const TraceBuffer& buffer = *buffers[b];
+    // the thread may still record: copy its spans, then drop those it
+    //  overwrote meanwhile
+    size_t n = buffer.count.load(memory_order_acquire);
+    size_t from = n > bufferSize ? n - bufferSize : 0;
+    vector<const char*> names(n - from);
+    vector<long long> begins(n - from), ends(n - from);
+    for (size_t k = from; k < n; k++) {
+      const Span& span = buffer.spans[k % bufferSize];
+      names[k - from] = span.name.load(memory_order_relaxed);
+      begins[k - from] = span.begin.load(memory_order_relaxed);
+      ends[k - from] = span.end.load(memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    // the span k is being overwritten from the count k + bufferSize on
+    size_t overwritten = buffer.count.load(memory_order_relaxed) + 1;
+    overwritten = overwritten > bufferSize ? overwritten - bufferSize : 0;
+
+    out << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+        << ", \"tid\": " << buffer.tid << ", \"args\": {\"name\": \"thread " << buffer.tid << "\"}}";
+    first = false;
+    for (size_t k = (std::max)(from, overwritten); k < n; k++)
+      out << ",\n{\"name\": \"" << names[k - from] << "\", \"ph\": \"X\", \"pid\": " << pid
+          << ", \"tid\": " << buffer.tid << ", \"ts\": " << begins[k - from] / 1000.
+          << ", \"dur\": " << (ends[k - from] - begins[k - from]) / 1000. << "}";
+  }
+  out << "\n]}" << endl;
+  return true;
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+
+using namespace std;
+
+namespace VCAPS
+{
+
+/*
+  timed spans of the pricing phases, written as a Chrome trace-event file
+  (chrome://tracing, Perfetto) to see the phases of each thread, their
+  overlap and the idle time in between. Nothing is recorded until
+  start(fileName), which also writes the file at exit.
+
+  Each thread records in its own ring buffer of bufferSize spans, so a
+  span costs two clock reads and no lock; when a buffer is full its
+  oldest spans are overwritten. A thread gives its buffer back when it
+  exits and the next new thread records in it, so the trace lanes are
+  buffers rather than threads and the loader threads started on each
+  load do not add up. There are at most maxBuffers, the threads that
+  find none free do not record. The span names must be string literals
+*/
+class Trace
+{
+public:
+  static const size_t bufferSize = 1 << 16;
+  static const size_t maxBuffers = 32;
+
+  static void start(const string& fileName);
+  static bool enabled() { return _enabled().load(memory_order_relaxed); }
+  // the spans recorded so far, normally left to the exit handler
+  static bool write();
+
+  // nanoseconds since start()
+  static long long now();
+  static void record(const char* name, long long begin, long long end);
+
+private:
+  static atomic<bool>& _enabled() { static atomic<bool> flag(false); return flag; }
+};
+
+class TraceScope
+{
+public:
+  explicit TraceScope(const char* name)
+    : _name(Trace::enabled() ? name : 0), _begin(_name ? Trace::now() : 0) {}
+  ~TraceScope() { if (_name) Trace::record(_name, _begin, Trace::now()); }
+
+private:
+  TraceScope(const TraceScope&);
+  void operator=(const TraceScope&);
+
+  const char* _name;
+  long long _begin;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// a span named name from here to the end of the enclosing block
+#define TRACE_SCOPE(name) VCAPS::TraceScope TRACE_CONCAT(_traceScope, __LINE__)(name)
+
+}
@@ -6,6 +6,9 @@
 #include <string>
 #include <algorithm>
 
+#include "RiskGroup.h"
+#include "EventCatalog.h"
+
 using namespace std;
 
 namespace VCAPS
@@ -13,14 +16,16 @@ namespace VCAPS
 
 typedef long long VLONG;
 
+/*
+  an occurrence of an event in a year: its losses, and its catalog id for
+  the attributes of the event, see EventCatalog
+*/
 struct VirtualEvent
 {
   double ripBase;
   double loss, reinstatementPrem, fullRip;
-  string riskGroup;
-  int eventId;
+  int catalogId; // EventCatalog id of the event ID and risk group, -1 if it was full
   int sequenceId;
-  bool noncat;
 
   typedef vector<VirtualEvent> VEC;
   typedef map<int, VirtualEvent> MAP;
@@ -30,26 +35,48 @@ struct VirtualEvent
 
   VirtualEvent()
     : ripBase(0), loss(0), reinstatementPrem(0), 
-    fullRip(0), riskGroup("NA"), eventId(0), sequenceId(0), noncat(false)
+    fullRip(0), catalogId(defaultCatalogId()), sequenceId(0)
   {}
 
   VirtualEvent(int eId, double l, double rip)
-    : ripBase(0), loss(loss), reinstatementPrem(rip), 
-    fullRip(0), riskGroup("NA"), eventId(eId), noncat(false)
+    : ripBase(0), loss(l), reinstatementPrem(rip), 
+    fullRip(0), catalogId(EventCatalog::intern(eId, RiskGroupTable::na())), sequenceId(0)
   {}
 
-  VirtualEvent(int eId, double l, double rip, string rg)
+  VirtualEvent(int eId, double l, double rip, const string& rg)
     : ripBase(0), loss(l), reinstatementPrem(rip), 
-    fullRip(0), riskGroup(rg), eventId(eId), noncat(false)
+    fullRip(0), catalogId(EventCatalog::intern(eId, rg)), sequenceId(0)
   {}
   
-  VirtualEvent(int eId, double l, double rip, string rg, double fullrip)
+  VirtualEvent(int eId, double l, double rip, const string& rg, double fullrip)
     : ripBase(0), loss(l), reinstatementPrem(rip), 
-    fullRip(fullrip), riskGroup(rg), eventId(eId), noncat(false)
+    fullRip(fullrip), catalogId(EventCatalog::intern(eId, rg)), sequenceId(0)
   {}
 
-  double get_lossNetOfReinstatePrem() { return loss - reinstatementPrem; }
-  double get_lossNetOfFullRip() { return loss - fullRip; }
+  // an event of the catalog, without looking its attributes up
+  static VirtualEvent cataloged(int catalogId, double l, double rip, double fullrip) {
+    VirtualEvent e;
+    e.catalogId = catalogId;
+    e.loss = l;
+    e.reinstatementPrem = rip;
+    e.fullRip = fullrip;
+    return e;
+  }
+
+  // event 0 of the NA risk group, interned once: the default constructor
+  //  runs on every map insert
+  static int defaultCatalogId() {
+    static const int id = EventCatalog::intern(0, RiskGroupTable::na());
+    return id;
+  }
+
+  int eventId() const { return EventCatalog::info(catalogId).eventId; }
+  int rgId() const { return EventCatalog::info(catalogId).rgId; }
+  const string& riskGroup() const { return *EventCatalog::info(catalogId).riskGroup; }
+  bool noncat() const { return RiskGroupTable::isNoncat(rgId()); }
+
+  double get_lossNetOfReinstatePrem() const { return loss - reinstatementPrem; }
+  double get_lossNetOfFullRip() const { return loss - fullRip; }
 
   void operator*=(double factor) {
     loss *= factor;
@@ -57,14 +84,22 @@ struct VirtualEvent
   }
 
   void scale(double factor, string rg) {
-    if(rg == "ALL" || rg == riskGroup) {
+    if(rg == "ALL" || rg == riskGroup()) {
+      loss *= factor;
+      reinstatementPrem *= factor;
+    }
+  }
+  
+  // by interned risk group id, no string compare
+  void scale(double factor, int rgIdToScale) {
+    if(rgIdToScale == rgId()) {
       loss *= factor;
       reinstatementPrem *= factor;
     }
   }
   
   void scale(double factor, vector<string> rgs) {
-    if(std::find(rgs.begin(), rgs.end(), riskGroup)!=rgs.end()) {
+    if(std::find(rgs.begin(), rgs.end(), riskGroup())!=rgs.end()) {
       loss *= factor;
       reinstatementPrem *= factor;
     }
@@ -94,14 +129,11 @@ struct VirtualEvent
 
   void operator+=(VirtualEvent& newEvent)
   {
-	  if(eventId != newEvent.eventId)
+	  if(catalogId != newEvent.catalogId && eventId() != newEvent.eventId()
+	     && !RiskGroupTable::isTerror(newEvent.rgId()))
 	  {
-      string rgTmp =newEvent.riskGroup;
-		  transform(rgTmp.begin(), rgTmp.end(), rgTmp.begin(), (int(*)(int)) toupper);
-		  if( rgTmp.substr(rgTmp.size()>4?rgTmp.size()-4:0) != "TERR") {
-			  cerr << "Error: attempting to add two events with different event ids: "
-				  << eventId << " in " << riskGroup << " != " << newEvent.eventId << " in " << rgTmp << endl;
-		  }
+		  cerr << "Error: attempting to add two events with different event ids: "
+			  << eventId() << " in " << riskGroup() << " != " << newEvent.eventId() << " in " << newEvent.riskGroup() << endl;
 	  }
 
 	  loss += newEvent.loss;
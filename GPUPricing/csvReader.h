@@ -164,6 +164,12 @@ private:
 
   char file_name[error::max_file_name_length+1];
 
+  // loader metrics, only updated at block boundaries
+  size_t bytes_read;
+  long long open_io_ns;
+  long long io_ns[thread_count]; // refills done by the thread
+  long long wait_ns[thread_count]; // waiting for the other threads at a refill
+
   void open_file(const char*file_name){
     file = std::fopen(file_name, "rb");
     if(file == 0){
@@ -177,8 +183,11 @@ private:
 
   void init(){
     finished_block_cnt = 0;
-    for (unsigned i = 0; i < thread_count; i++)
+    for (unsigned i = 0; i < thread_count; i++) {
       file_line[i] = 0;
+      io_ns[i] = 0;
+      wait_ns[i] = 0;
+    }
 
     // do the buffering ourself.
     std::setvbuf(file, 0, _IONBF, 0);
@@ -194,8 +203,8 @@ private:
     
     high_resolution_clock::time_point _start = high_resolution_clock::now();
     data_end = (int)std::fread(buffer, 1, 2*block_len, file);
-    nanoseconds ns = duration_cast<nanoseconds>(high_resolution_clock::now() - _start);
-    cerr << " reading stream@ " << (ns.count() / 1000000) << " ms " << endl;
+    open_io_ns = duration_cast<nanoseconds>(high_resolution_clock::now() - _start).count();
+    bytes_read = data_end;
 
     // Ignore UTF-8 BOM
     if (data_end >= 3 && buffer[0] == '\xEF' && buffer[1] == '\xBB' && buffer[2] == '\xBF')
@@ -237,6 +246,15 @@ public:
     this->file_name[error::max_file_name_length] = '\0';
   }
   const char*get_file_name()const { return file_name; }
+  size_t get_bytes_read() const { return bytes_read; }
+  long long get_io_nanoseconds() const {
+    long long total = open_io_ns;
+    for (unsigned i = 0; i < thread_count; i++)
+      total += io_ns[i];
+    return total;
+  }
+  long long get_io_nanoseconds(int threadNo) const { return io_ns[threadNo]; }
+  long long get_wait_nanoseconds(int threadNo) const { return wait_ns[threadNo]; }
   void set_file_line(unsigned file_line, int threadNo){ this->file_line[threadNo] = file_line; }
   unsigned get_file_line(int threadNo)const { return file_line[threadNo]; }
   int get_block_begin(int threadNo) const{ 
@@ -271,7 +289,9 @@ public:
         return 0;
       } else if (++finished_block_cnt < thread_count) {
         //cerr << "Thread " << threadNo << " blocked." << finished_block_cnt<< endl;
+        high_resolution_clock::time_point _start = high_resolution_clock::now();
         cv.wait(lck);
+        wait_ns[threadNo] += duration_cast<nanoseconds>(high_resolution_clock::now() - _start).count();
         startAfterBlock = true;
         //cerr << "Thread " << threadNo << " released." << endl;
         if (finished_block_cnt < 0) {
@@ -279,7 +299,11 @@ public:
           return 0;
         }
       } else {
+        high_resolution_clock::time_point _start = high_resolution_clock::now();
         int lenRead = (int)std::fread(buffer + data_end, 1, block_len, file);
+        io_ns[threadNo] += duration_cast<nanoseconds>(high_resolution_clock::now() - _start).count();
+        if (lenRead > 0)
+          bytes_read += lenRead;
 
         //cerr << ": Thread " << threadNo << " feed in more data: " << lenRead << endl;
         if (lenRead <= 0 && block_end[thread_count - 1] == data_end) {
@@ -575,6 +599,9 @@ private:
       case Int:
         memSize += sizeof(int);
         break;
+      case Long:
+        memSize += sizeof(long);
+        break;
       case Float:
         memSize += sizeof(float);
         break;
@@ -630,6 +657,11 @@ public:
 
   unsigned get_file_line()const{ return in.get_file_line(); }
 
+  size_t get_bytes_read() const { return in.get_bytes_read(); }
+  long long get_io_nanoseconds() const { return in.get_io_nanoseconds(); }
+  long long get_io_nanoseconds(int threadNo) const { return in.get_io_nanoseconds(threadNo); }
+  long long get_wait_nanoseconds(int threadNo) const { return in.get_wait_nanoseconds(threadNo); }
+
 private:
   void init()
   {
@@ -2,6 +2,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <stdlib.h>
 #include <values.h>
 #include <getopt.h>
@@ -11,16 +12,401 @@
 
 #include <omp.h>
 
+#include "Reinstatement.h"
+#include "PricingServer.h"
+#include "Trace.h"
+#include "Log.h"
+
+static vector<string> split(const string& s, const string& delim)
+{
+  vector<string> parts;
+  size_t begin = 0, end;
+  while ((end = s.find(delim, begin)) != string::npos) {
+    parts.push_back(s.substr(begin, end - begin));
+    begin = end + delim.size();
+  }
+  parts.push_back(s.substr(begin));
+  return parts;
+}
+
+static double parseAmount(const string& s)
+{
+  if (s == "-" || s.empty())
+    return numeric_limits<double>::infinity();
+  return atof(s.c_str());
+}
+
 Pricing::Pricing()
+  : fileDelim("+"), minLossToInclude(0)
+{
+}
+
+bool Pricing::parseContract(const string& line, Contract& c, string& error)
+{
+  vector<string> fields = split(line, "\t");
+  if (fields.size() < 9) {
+    stringstream ss;
+    ss << fields.size() << " fields instead of 9";
+    error = ss.str();
+    return false;
+  }
+
+  c = Contract();
+  c.id = fields[0];
+  c.simulationFiles = fields[1];
+  c.layer.name = c.id;
+  c.layer.occRetention = atof(fields[2].c_str());
+  c.layer.occLimit = parseAmount(fields[3]);
+  c.layer.aggDeductible = atof(fields[4].c_str());
+  c.layer.aggLimit = parseAmount(fields[5]);
+  c.layer.share = atof(fields[6].c_str());
+  c.layer.premium = atof(fields[7].c_str());
+  if (fields[8] != "-") {
+    vector<string> rates = split(fields[8], ",");
+    for (size_t k = 0; k < rates.size(); k++)
+      c.layer.reinstatementRates.push_back(atof(rates[k].c_str()));
+  }
+  return true;
+}
+
+bool Pricing::readJobFile(string fileName)
+{
+  ifstream in(fileName.c_str());
+  if (!in) {
+    cerr << "Error: job file " << fileName << " not openable" << endl;
+    return false;
+  }
+
+  _contracts.clear();
+  string line, error;
+  int lineNo = 0;
+  while (getline(in, line)) {
+    lineNo++;
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.erase(line.size() - 1);
+    if (line.empty() || line[0] == '#')
+      continue;
+    Contract c;
+    if (!parseContract(line, c, error)) {
+      cerr << "Error: line " << lineNo << " of " << fileName << ": " << error << endl;
+      return false;
+    }
+    _contracts.push_back(c);
+  }
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "\t " << _contracts.size() << " contracts in "
+       << fileName);
+  return true;
+}
+
+bool Pricing::_loadSimulationFromFile(Simulation& sim, string fileNames, string delim, bool isTerror,
+                                      string& error)
+{
+  vector<string> files = split(fileNames, delim);
+  for (size_t i = 0; i < files.size(); i++) {
+    string key = (isTerror ? "T:" : "") + files[i];
+    map<string, Simulation>::iterator it = _fileCache.find(key);
+    if (it == _fileCache.end()) {
+      Simulation loaded;
+      if (!loaded.readFromFile(files[i], minLossToInclude, "")) {
+        error = files[i] + " not loadable";
+        return false;
+      }
+      // terror events merge with gross events of other event ids when
+      //  their risk group is a terror one, see VirtualEvent::operator+=
+      if (isTerror)
+        for (Simulation::RGMAP::const_iterator ir = loaded.riskGroupMap.begin();
+             ir != loaded.riskGroupMap.end(); ir++)
+          if (!RiskGroupTable::isTerror(RiskGroupTable::intern(ir->first)))
+            VCAPS_LOG(LOG_WARN, "Warning: risk group " << ir->first << " of the terror file "
+                 << files[i] << " is not a terror one");
+      it = _fileCache.insert(pair<string, Simulation>(key, loaded)).first;
+    }
+
+    // copies share the cached store
+    if (sim.empty() && sim.get_numIter() == 0)
+      sim = it->second;
+    else if (sim.get_numIter() != it->second.get_numIter() && !it->second.empty()) {
+      stringstream ss;
+      ss << "_numIter " << it->second.get_numIter() << " of " << files[i] << " instead of "
+         << sim.get_numIter();
+      error = ss.str();
+      return false;
+    }
+    else if (!sim.add(it->second, error)) {
+      error = files[i] + ": " + error;
+      return false;
+    }
+  }
+  return true;
+}
+
+Simulation* Pricing::_getSimulation(const string& fileNames, string& error)
+{
+  map<string, Simulation>::iterator it = _simulationCache.find(fileNames);
+  if (it != _simulationCache.end())
+    return &it->second;
+
+  string gross, terror;
+  vector<string> files = split(fileNames, fileDelim);
+  for (size_t i = 0; i < files.size(); i++) {
+    bool isTerror = files[i].compare(0, 2, "T:") == 0;
+    string& list = isTerror ? terror : gross;
+    list += (list.empty() ? "" : fileDelim) + (isTerror ? files[i].substr(2) : files[i]);
+  }
+
+  Simulation& sim = _simulationCache[fileNames];
+  if ((!gross.empty() && !_loadSimulationFromFile(sim, gross, fileDelim, false, error))
+      || (!terror.empty() && !_loadSimulationFromFile(sim, terror, fileDelim, true, error))) {
+    _simulationCache.erase(fileNames);
+    return 0;
+  }
+  return &sim;
+}
+
+static bool isShared(const string& fileNames)
+{
+  return fileNames.compare(0, 4, "shm:") == 0;
+}
+
+string Pricing::missingFile(const string& fileNames) const
+{
+  if (isShared(fileNames))
+    return EventTable::isPublished(fileNames.substr(4)) ? "" : fileNames;
+  vector<string> files = split(fileNames, fileDelim);
+  for (size_t i = 0; i < files.size(); i++) {
+    string file = files[i].compare(0, 2, "T:") == 0 ? files[i].substr(2) : files[i];
+    if (!ToolBox::fileExists(file))
+      return file;
+  }
+  return "";
+}
+
+shared_ptr<const Pricing::Cached> Pricing::_load(const string& fileNames)
+{
+  shared_ptr<Cached> cached = make_shared<Cached>();
+  if (isShared(fileNames)) {
+    EventTable table;
+    if (!EventTable::attach(fileNames.substr(4), table)) {
+      cached->error = "no simulation published as " + fileNames.substr(4);
+      return cached;
+    }
+    cached->engine = make_shared<LayerTermsEngine>(table);
+    return cached;
+  }
+  lock_guard<mutex> lock(_loadMutex);
+  Simulation* sim = _getSimulation(fileNames, cached->error);
+  if (!sim)
+    return cached;
+  cached->engine = make_shared<LayerTermsEngine>(*sim);
+  cached->gross = sim;
+  return cached;
+}
+
+shared_ptr<const Pricing::Cached> Pricing::_getCached(const string& fileNames, string& error)
+{
+  // the first request of a simulation loads it, outside the cache lock:
+  //  the requests of the other simulations do not wait for it
+  promise< shared_ptr<const Cached> > loading;
+  shared_future< shared_ptr<const Cached> > loaded;
+  bool isLoader = false;
+  {
+    lock_guard<mutex> lock(_cacheMutex);
+    map<string, shared_future< shared_ptr<const Cached> > >::iterator it = _engineCache.find(fileNames);
+    if (it != _engineCache.end())
+      loaded = it->second;
+    else {
+      loaded = _engineCache[fileNames] = loading.get_future().share();
+      isLoader = true;
+    }
+  }
+  if (isLoader) {
+    shared_ptr<const Cached> cached;
+    try {
+      cached = _load(fileNames);
+    }
+    catch (...) {
+      {
+        lock_guard<mutex> lock(_cacheMutex);
+        _engineCache.erase(fileNames);
+      }
+      loading.set_exception(current_exception());
+      throw;
+    }
+    // a failed load is retried by the next request, the file may be fixed
+    if (!cached->engine) {
+      lock_guard<mutex> lock(_cacheMutex);
+      _engineCache.erase(fileNames);
+    }
+    loading.set_value(cached);
+  }
+  shared_ptr<const Cached> cached = loaded.get();
+  if (!cached->engine) {
+    error = cached->error;
+    return shared_ptr<const Cached>();
+  }
+  return cached;
+}
+
+shared_ptr<const LayerTermsEngine> Pricing::_getEngine(const string& fileNames, string& error)
 {
+  shared_ptr<const Cached> cached = _getCached(fileNames, error);
+  return cached ? cached->engine : shared_ptr<const LayerTermsEngine>();
+}
+
+const Simulation* Pricing::_getGross(const string& fileNames, string& error)
+{
+  shared_ptr<const Cached> cached = _getCached(fileNames, error);
+  if (!cached)
+    return 0;
+  if (cached->gross)
+    return cached->gross;
+  call_once(cached->rebuilt, [&cached]() { cached->shared = cached->engine->get_table().toSimulation(); });
+  return &cached->shared;
+}
+
+bool Pricing::publish(const string& name, const string& fileNames)
+{
+  string error;
+  lock_guard<mutex> lock(_loadMutex);
+  Simulation* sim = _getSimulation(fileNames, error);
+  if (!sim) {
+    cerr << "Error: " << error << endl;
+    return false;
+  }
+  EventTable table(*sim);
+  if (!table.publish(name))
+    return false;
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "\t published " << table.numEvents() << " events of "
+       << fileNames << " as shm:" << name);
+  return true;
+}
+
+bool Pricing::preload(const vector<Contract>& contracts)
+{
+  string error;
+  for (size_t i = 0; i < contracts.size(); i++)
+    if (!_getEngine(contracts[i].simulationFiles, error)) {
+      cerr << "Error: " << error << endl;
+      return false;
+    }
+  return true;
+}
+
+bool Pricing::priceContracts(vector<ContractResult>& results)
+{
+  string error;
+  if (priceContracts(_contracts, tvarProbs, results, error))
+    return true;
+  cerr << "Error: " << error << endl;
+  return false;
+}
+
+bool Pricing::priceContracts(const vector<Contract>& contracts, const vector<double>& probs,
+                             vector<ContractResult>& results, string& error)
+{
+  results.assign(contracts.size(), ContractResult());
+
+  map<string, vector<int> > bySimulation;
+  for (int i = 0; i < (int)contracts.size(); i++)
+    bySimulation[contracts[i].simulationFiles].push_back(i);
+
+  for (map<string, vector<int> >::iterator is = bySimulation.begin(); is != bySimulation.end(); is++) {
+    shared_ptr<const LayerTermsEngine> engine = _getEngine(is->first, error);
+    if (!engine)
+      return false;
+    const vector<int>& ids = is->second;
+
+    vector<Layer> layers;
+    const Simulation* gross = 0;
+    for (size_t k = 0; k < ids.size(); k++) {
+      layers.push_back(contracts[ids[k]].layer);
+      if (!gross && !layers.back().reinstatementRates.empty()) {
+        gross = _getGross(is->first, error);
+        if (!gross)
+          return false;
+      }
+    }
+    vector<AnnualLoss> ceded;
+    engine->apply(layers, ceded);
+
+    // one level of parallelism: the contracts one after the other, the
+    //  reductions and the reinstatements of each in parallel
+    TRACE_SCOPE("metrics");
+    long n = (long)ids.size();
+    for (long k = 0; k < n; k++) {
+      TRACE_SCOPE("contract metrics");
+      ContractResult& r = results[ids[k]];
+      pair<double, double> elsd = ceded[k].get_expected_sd();
+      r.expectedLoss = elsd.first;
+      r.sd = elsd.second;
+      for (size_t p = 0; p < probs.size(); p++)
+        r.tvars.push_back(ceded[k].getTVaR(probs[p]));
+      if (!layers[k].reinstatementRates.empty()) {
+        TRACE_SCOPE("reinstatements");
+        Simulation withRip = ReinstatementEngine::apply(*gross, layers[k]);
+        r.expectedReinstatePrem = elsd.first - withRip.get_expected_sd(true).first;
+      }
+    }
+  }
+  return true;
+}
+
+void Pricing::writeResults(const vector<ContractResult>& results, ostream& out)
+{
+  writeResults(_contracts, tvarProbs, results, out);
+}
+
+void Pricing::writeResults(const vector<Contract>& contracts, const vector<double>& probs,
+                           const vector<ContractResult>& results, ostream& out)
+{
+  out << "contractId\texpectedLoss\tsd\texpectedReinstatePrem";
+  for (size_t p = 0; p < probs.size(); p++)
+    out << "\tTVaR_" << probs[p];
+  out << endl;
+  out.precision(12);
+  for (size_t i = 0; i < results.size(); i++) {
+    out << contracts[i].id << "\t" << results[i].expectedLoss << "\t" << results[i].sd
+        << "\t" << results[i].expectedReinstatePrem;
+    for (size_t p = 0; p < results[i].tvars.size(); p++)
+      out << "\t" << results[i].tvars[p];
+    out << endl;
+  }
 }
 
 void Pricing::execution()
 {
+  // the results alone on stdout
+  if (outputFileName.empty())
+    Log::allToStderr();
+  if (!readJobFile(jobFileName))
+    exit(-1);
+
+  vector<ContractResult> results;
+  if (!priceContracts(results))
+    exit(-1);
+
+  if (outputFileName.empty())
+    writeResults(results, cout);
+  else {
+    ofstream out(outputFileName.c_str());
+    writeResults(results, out);
+  }
+  VCAPS_LOG(LOG_INFO, ToolBox::getAscTime() << "\t priced " << results.size() << " contracts against "
+       << _simulationCache.size() << " simulations");
 }
 
+// the tests link the Pricing class without the driver
+#ifndef PRICING_NO_MAIN
 void Usage()
 {
+  cerr << "Usage: pricing -B <job file> [-o <output file>] [-M <min loss>]" << endl
+       << "               [-p <TVaR probabilities, comma separated>] [-d <file delimiter>]" << endl
+       << "               [-n <threads>] [-T <Chrome trace file>]" << endl
+       << "               [-v <log level: 0 errors, 1 warnings, 2 info, 3 debug>]" << endl
+       << "       pricing -S <socket> [-B <job file to preload>] [-x <connections>]" << endl
+       << "               [-M <min loss>] [-d <file delimiter>] [-n <threads>]" << endl
+       << "       pricing -P <shared memory name> -F <simulation files> [-M <min loss>]" << endl
+       << "       pricing -U <shared memory name>" << endl;
 }
 
 int main(int argc, char** argv)
@@ -30,19 +416,88 @@ int main(int argc, char** argv)
     exit(-1);
   }
 
+  Pricing pricing;
+  string socketPath, publishName, publishFiles;
+  int numConnections = 4;
   extern char* optarg;
   extern int optind;
   char c=0;
-  while((c=getopt(argc,argv,":A:a:B:M:o:S:e:p:x:n:d:b:s:P:Z:L:l:T:F:C:D:"))!=EOF){
-    cerr << "<" <<c<<">";
+  while((c=getopt(argc,argv,":A:a:B:M:o:S:e:p:x:n:d:b:s:P:Z:L:l:T:F:C:D:U:v:"))!=EOF){
     switch(c)
     {
-    case 'A':
+    case 'B':
+      pricing.jobFileName = optarg;
+      break;
+    case 'o':
+      pricing.outputFileName = optarg;
+      break;
+    case 'M':
+      pricing.minLossToInclude = atof(optarg);
+      break;
+    case 'p': {
+      vector<string> probs = split(optarg, ",");
+      for (size_t k = 0; k < probs.size(); k++)
+        pricing.tvarProbs.push_back(atof(probs[k].c_str()));
+      break;
+    }
+    case 'd':
+      pricing.fileDelim = optarg;
+      break;
+    case 'n':
+      omp_set_num_threads(atoi(optarg));
+      break;
+    case 'S':
+      socketPath = optarg;
+      break;
+    case 'x':
+      numConnections = atoi(optarg);
+      break;
+    case 'P':
+      publishName = optarg;
+      break;
+    case 'F':
+      publishFiles = optarg;
+      break;
+    case 'U':
+      EventTable::unpublish(optarg);
+      return 0;
+    case 'T':
+      Trace::start(optarg);
+      break;
+    case 'v':
+      Log::setLevel((LogLevel)atoi(optarg));
       break;
     default:
       Usage();
       exit(-1);
     }
   }
-  return 0; 
+
+  if (!publishName.empty()) {
+    if (publishFiles.empty()) {
+      Usage();
+      exit(-1);
+    }
+    return pricing.publish(publishName, publishFiles) ? 0 : -1;
+  }
+
+  if (!socketPath.empty()) {
+    if (!pricing.jobFileName.empty()) {
+      if (!pricing.readJobFile(pricing.jobFileName))
+        exit(-1);
+      if (!pricing.preload(pricing.get_contracts()))
+        exit(-1);
+    }
+    if (!PricingServer(pricing, socketPath, numConnections).run())
+      exit(-1);
+    return 0;
+  }
+
+  if (pricing.jobFileName.empty()) {
+    Usage();
+    exit(-1);
+  }
+  pricing.execution();
+  return 0;
 }
+#endif
@@ -6,12 +6,43 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <memory>
+#include <mutex>
+#include <future>
 
 #include "Simulation.h"
+#include "LayerTerms.h"
 
 using namespace std;
 using namespace VCAPS;
 
+/*
+  one line of the job file (tab separated, # for comments):
+    contractId simulationFiles occRetention occLimit aggDeductible aggLimit
+    share premium reinstatementRates
+  simulationFiles are joined by the file delimiter and summed, a file
+  prefixed by "T:" is a terror simulation, whose risk groups are terror
+  ones (named ...TERR, see RiskGroupTable); reinstatementRates is a comma
+  separated list, or "-" for none; "-" for a limit means unlimited.
+  simulationFiles "shm:<name>" is a simulation published by pricing -P,
+  attached in place instead of read
+*/
+struct Contract
+{
+  string id;
+  string simulationFiles;
+  Layer layer;
+};
+
+struct ContractResult
+{
+  double expectedLoss, sd;
+  double expectedReinstatePrem;
+  vector<double> tvars;
+
+  ContractResult() : expectedLoss(0), sd(0), expectedReinstatePrem(0) {}
+};
+
 class Pricing
 {
 public:
@@ -19,8 +50,75 @@ public:
 
   void execution();
 
+  // options
+  string jobFileName;
+  string outputFileName;      // stdout if empty
+  string fileDelim;
+  double minLossToInclude;
+  vector<double> tvarProbs;
+
+  bool readJobFile(string fileName);
+  bool priceContracts(vector<ContractResult>& results);
+  void writeResults(const vector<ContractResult>& results, ostream& out);
+
+  // one line of the job file, false and the reason if malformed
+  static bool parseContract(const string& line, Contract& contract, string& error);
+  // thread safe: the simulations are loaded once and then only read, so
+  //  concurrent requests of the PricingServer share them. False and the
+  //  reason if a simulation can not be loaded
+  bool priceContracts(const vector<Contract>& contracts, const vector<double>& probs,
+                      vector<ContractResult>& results, string& error);
+  static void writeResults(const vector<Contract>& contracts, const vector<double>& probs,
+                           const vector<ContractResult>& results, ostream& out);
+  // the first file of a simulation spec that does not exist, or ""
+  string missingFile(const string& fileNames) const;
+  // the table of the summed files in shared memory, for the other
+  //  processes of the host to price against shm:<name>
+  bool publish(const string& name, const string& fileNames);
+  // loads the simulations of the contracts not loaded yet
+  bool preload(const vector<Contract>& contracts);
+  const vector<Contract>& get_contracts() const { return _contracts; }
+
 protected:
-  void _loadSimulationFromFile(Simulation& sim, string fileNames, string delim, bool isTerror);
+  // a simulation of the caches, loaded once by the first request for it
+  struct Cached
+  {
+    shared_ptr<const LayerTermsEngine> engine;
+    // the summed files, 0 if the simulation is shared: it is then
+    //  rebuilt from the table on first use
+    const Simulation* gross;
+    mutable once_flag rebuilt;
+    mutable Simulation shared;
+    // why engine is null
+    string error;
+
+    Cached() : gross(0) {}
+  };
+
+  // _fileCache and _simulationCache are used under _loadMutex only
+  bool _loadSimulationFromFile(Simulation& sim, string fileNames, string delim, bool isTerror,
+                               string& error);
+  // the sum of the files of a contract, each file read once per process;
+  //  the loaders fail instead of exiting, so a malformed file only fails
+  //  the contracts priced against it: 0 and the reason then
+  Simulation* _getSimulation(const string& fileNames, string& error);
+  shared_ptr<const Cached> _load(const string& fileNames);
+  // the cached simulation, waiting for its load if it is under way;
+  //  null and the reason if it can not be loaded
+  shared_ptr<const Cached> _getCached(const string& fileNames, string& error);
+  // the flattened table of a simulation, built or attached on first use
+  shared_ptr<const LayerTermsEngine> _getEngine(const string& fileNames, string& error);
+  // the Simulation itself, rebuilt from the table if it is shared
+  const Simulation* _getGross(const string& fileNames, string& error);
+
+  vector<Contract> _contracts;
+  map<string, Simulation> _fileCache;
+  map<string, Simulation> _simulationCache;
+  map<string, shared_future< shared_ptr<const Cached> > > _engineCache;
+  // guards _engineCache, held for lookups only
+  mutex _cacheMutex;
+  // the file reader is shared, so the loads are serial
+  mutex _loadMutex;
 };
 
 #endif
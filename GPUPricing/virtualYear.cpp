@@ -6,12 +6,56 @@
 namespace VCAPS
 {
 
-void VirtualYear::addVirtualEvent(int sequenceId, VirtualEvent e, double factor, 
+int NoncatSlots::take(int sequenceId, const VirtualEvent::MAP& events)
+{
+  int base = sequenceId - (sequenceId % 1000);
+  if (!_blocks)
+    _blocks.reset(new unordered_map<int, Block>());
+  pair<unordered_map<int, Block>::iterator, bool> ib = _blocks->insert(make_pair(base, Block()));
+  Block& block = ib.first->second;
+  if (ib.second) {
+    std::fill(block.used, block.used + (numSlots + 63) / 64, 0);
+    VirtualEvent::MAP::const_iterator iE = events.lower_bound(base + first);
+    for (; iE != events.end() && iE->first <= base + last; iE++) {
+      int slot = iE->first - base - first;
+      block.used[slot / 64] |= (uint64_t)1 << (slot % 64);
+    }
+  }
+
+  for (int w = 0; w * 64 < numSlots; w++) {
+    uint64_t free = ~block.used[w];
+    if (numSlots - w * 64 < 64)
+      free &= ((uint64_t)1 << (numSlots - w * 64)) - 1;
+    if (free) {
+      int bit = __builtin_ctzll(free);
+      block.used[w] |= (uint64_t)1 << bit;
+      return base + first + w * 64 + bit;
+    }
+  }
+  return -1;
+}
+
+void NoncatSlots::_use(int sequenceId)
+{
+  int base = sequenceId - (sequenceId % 1000);
+  int slot = sequenceId - base - first;
+  if (slot < 0 || slot >= numSlots)
+    return;
+  unordered_map<int, Block>::iterator ib = _blocks->find(base);
+  if (ib != _blocks->end())
+    ib->second.used[slot / 64] |= (uint64_t)1 << (slot % 64);
+}
+
+bool VirtualYear::addVirtualEvent(int sequenceId, VirtualEvent e, double factor, 
                                   VLONG iterId, bool addhead)
 {
   this->iterId = iterId;
+  if (e.catalogId < 0) {
+    cerr << "Error: the event catalog is full, an event of iteration " << iterId << " not added" << endl;
+    return false;
+  }
+  materialize();
 
-  string newRG = e.riskGroup;
   e *= factor;
 
   VirtualEvent::Iterator iE = _events.find(sequenceId);
@@ -19,39 +63,39 @@ void VirtualYear::addVirtualEvent(int sequenceId, VirtualEvent e, double factor,
     e.sequenceId = sequenceId;
     if (addhead)
       _head_events.push_back(e);
-    _events[sequenceId] = e;
+    _events.insert(iE, VirtualEvent::Pair(sequenceId, e));
+    _noncatSlots.use(sequenceId);
   }
   else {
-    string existingRG = iE->second.riskGroup;
-    if(newRG.find("Noncat-") == string::npos || existingRG == newRG) 
+    if(!RiskGroupTable::isNoncat(e.rgId()) || iE->second.rgId() == e.rgId())
       iE->second += e; 
     else {
-      int newSeqId;
-      int c = 500;
-      do {
-        c++;
-        newSeqId = sequenceId - (sequenceId % 1000) + c;
-      } while( _events.find(newSeqId) != _events.end() && c != 999);
-      if(c != 999)
-        _events[newSeqId] = e;
-      else
-        exit(0);
+      int newSeqId = _noncatSlots.take(sequenceId, _events);
+      if (newSeqId < 0) {
+        cerr << "Error: no free sequence id left in iteration " << iterId << " for the "
+             << e.riskGroup() << " event " << e.eventId() << " colliding at " << sequenceId << endl;
+        return false;
+      }
+      _events[newSeqId] = e;
     }
   }
+  return true;
 }
 
-void VirtualYear::addVirtualEvents(VirtualYear& y)
+bool VirtualYear::addVirtualEvents(VirtualYear& y)
 {
+  bool added = true;
   for (VirtualEvent::VEC::iterator ie = y._head_events.begin(); ie != y._head_events.end(); ++ie)
-    addVirtualEvent(ie->sequenceId, *ie, 1.0, y.iterId);
+    added &= addVirtualEvent(ie->sequenceId, *ie, 1.0, y.iterId);
   y._head_events.clear();
+  return added;
 }
 
 VirtualYear& VirtualYear::operator+=(const VirtualYear& newVirtualYear)
 {
   const VirtualEvent::MAP & newEvents = newVirtualYear._events;
   for(VirtualEvent::ConstIterator iE = newEvents.begin(); iE != newEvents.end(); iE++)
-    addVirtualEvent(iE->first, iE->second, 1, 0, false);
+    addVirtualEvent(iE->first, iE->second, newVirtualYear._factor, 0, false);
   return *this;
 }
 
@@ -59,36 +103,49 @@ VirtualYear& VirtualYear::operator-=(const VirtualYear& newVirtualYear)
 {
   const VirtualEvent::MAP & newEvents = newVirtualYear._events;
   for(VirtualEvent::ConstIterator iE = newEvents.begin(); iE != newEvents.end(); iE++)
-    addVirtualEvent(iE->first, iE->second, -1);
+    addVirtualEvent(iE->first, iE->second, -newVirtualYear._factor);
   return *this;
 }
 
-VirtualYear VirtualYear::operator-()
+int VirtualYear::addScaled(const VirtualYear& y, const ScaleFactors& factors, double sign)
+{
+  double yearFactor = sign * y._factor;
+  int dropped = 0;
+  for(VirtualEvent::ConstIterator iE = y._events.begin(); iE != y._events.end(); iE++)
+    if (!addVirtualEvent(iE->first, iE->second, yearFactor * factors.of(iE->second), iterId, false))
+      dropped++;
+  return dropped;
+}
+
+VirtualYear VirtualYear::operator-() const
 {
   VirtualYear res;
-  for(VirtualEvent::Iterator iE = _events.begin(); iE != _events.end(); iE++)
-    res.addVirtualEvent(iE->first, iE->second, -1);
+  for(VirtualEvent::ConstIterator iE = _events.begin(); iE != _events.end(); iE++)
+    res.addVirtualEvent(iE->first, iE->second, -_factor);
   res.iterId = iterId;
   return res;
 }
 
-void VirtualYear::operator*=(double factor)
+void VirtualYear::materialize()
 {
+  if (_factor == 1)
+    return;
   for(VirtualEvent::Iterator i = _events.begin(); i != _events.end(); i++)
-    i->second *= factor;
+    i->second *= _factor;
+  _factor = 1;
 }
 
-double VirtualYear::GetTotalLoss(bool includeReinstatePrem)
+double VirtualYear::GetTotalLoss(bool includeReinstatePrem) const
 {
   double totalLoss = 0.0;
-  for (VirtualEvent::Iterator iE = _events.begin(); iE != _events.end(); iE ++) {
+  for (VirtualEvent::ConstIterator iE = _events.begin(); iE != _events.end(); iE ++) {
     if(!includeReinstatePrem)
       totalLoss += iE->second.loss;
     else
       totalLoss += iE->second.get_lossNetOfReinstatePrem();
   }
 
-  return totalLoss;
+  return totalLoss * _factor;
 }
 
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "VirtualEvent.h"
+#include "ScaleFactors.h"
 
 #include <map>
 #include <set>
@@ -10,6 +11,8 @@
 #include <iterator>
 
 #include <unordered_map>
+#include <memory>
+#include <stdint.h>
 
 //#define HASH_MAP unordered_map
 #define HASH_MAP map
@@ -19,6 +22,45 @@ using namespace std;
 namespace VCAPS
 {
 
+/*
+  the free sequence ids 501..998 of each thousand-block of a year, where
+  addVirtualEvent moves the Noncat- events colliding with an event of
+  another risk group: one bit per id, so the first free one is found
+  with a few word operations instead of a map lookup per id. A block is
+  indexed from the events on its first collision. This is a cache of the
+  events: copies start empty, and the year drops it when its events may
+  change behind it
+*/
+class NoncatSlots
+{
+public:
+  static const int first = 501, last = 998;
+
+  NoncatSlots() {}
+  NoncatSlots(const NoncatSlots&) {}
+  NoncatSlots& operator=(const NoncatSlots&) { clear(); return *this; }
+
+  void clear() { _blocks.reset(); }
+  void swap(NoncatSlots& other) { _blocks.swap(other._blocks); }
+
+  // takes the first free id of the block of sequenceId, -1 if there is none
+  int take(int sequenceId, const VirtualEvent::MAP& events);
+  // sequenceId got used by an event
+  void use(int sequenceId) {
+    if (_blocks)
+      _use(sequenceId);
+  }
+
+private:
+  static const int numSlots = last - first + 1;
+  struct Block { uint64_t used[(numSlots + 63) / 64]; };
+
+  void _use(int sequenceId);
+
+  // key = first sequence id of the block
+  unique_ptr< unordered_map<int, Block> > _blocks;
+};
+
 class VirtualYear
 {
 public:
@@ -30,34 +72,58 @@ public:
   bool less(VirtualYear::Pair& a, VirtualYear::Pair& b) { return a.first < b.first; }
 
 public:
-  VirtualYear() {}
-  VirtualYear(VirtualEvent::MAP events) : _events(events) {}
+  VirtualYear() : iterId(0), _factor(1) {}
+  VirtualYear(VirtualEvent::MAP events) : iterId(0), _events(events), _factor(1) {}
   ~VirtualYear() { clear(); }
 
   void clear() {
     _events.clear();
     _head_events.clear();
+    _noncatSlots.clear();
+    _factor = 1;
   }
   void swap(VirtualYear& y) { 
     _events.swap(y._events); std::swap(y.iterId, iterId); 
     _head_events.swap(y._head_events);
+    _noncatSlots.swap(y._noncatSlots);
+    std::swap(y._factor, _factor);
   }
 
-  void addVirtualEvent(int sequenceId, VirtualEvent e, double factor=1.0,
+  /*
+    adds e to the event at sequenceId, or stores it there if there is
+    none. A Noncat- event colliding with an event of another risk group
+    goes to a free id 501..998 of the thousand-block of sequenceId; false,
+    and why on cerr, if there is none left (e is not added then)
+  */
+  bool addVirtualEvent(int sequenceId, VirtualEvent e, double factor=1.0,
                        VLONG iterId=0, bool addhead=true);
-  void addVirtualEvents(VirtualYear& events);
+  bool addVirtualEvents(VirtualYear& events);
   void updateVirtualEvent(int sequenceId, VirtualEvent e);
 
   VirtualYear& operator+=(const VirtualYear& newVirtualYear);
   VirtualYear& operator-=(const VirtualYear& newVirtualYear);
-  VirtualYear operator-();
-  VirtualEvent& operator[](int seqId) { return _events[seqId]; }
-  void operator*=(double factor);
+  // adds sign * the events of y, each scaled by y's factor and
+  //  factors.of(event); the number of them not added for want of a Noncat
+  //  sequence id, see addVirtualEvent
+  int addScaled(const VirtualYear& y, const ScaleFactors& factors, double sign=1.0);
+  VirtualYear operator-() const;
+  VirtualEvent& operator[](int seqId) {
+    materialize();
+    _noncatSlots.use(seqId);
+    return _events[seqId];
+  }
+
+  // deferred: recorded in O(1) and applied by materialize()
+  void operator*=(double factor) { _factor *= factor; }
+  double factor() const { return _factor; }
+  void materialize();
 
-  VirtualEvent::MAP & get_events() { return _events; }
-  int size(){ return (int)_events.size(); };
+  VirtualEvent::MAP & get_events() { materialize(); _noncatSlots.clear(); return _events; }
+  // the events before factor() is applied
+  const VirtualEvent::MAP & get_events() const { return _events; }
+  int size() const { return (int)_events.size(); };
 
-  double GetTotalLoss(bool includeReinstatePrem);
+  double GetTotalLoss(bool includeReinstatePrem) const;
 
   VLONG iterId;
 
@@ -65,6 +131,9 @@ private:
   // key = event sequence ID in a year
   VirtualEvent::MAP _events;
   VirtualEvent::VEC _head_events;
+  NoncatSlots _noncatSlots;
+  // pending factor for all the events of the year
+  double _factor;
 };
 
 }
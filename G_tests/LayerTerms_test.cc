@@ -0,0 +1,145 @@
+#include <limits.h>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include "LayerTerms.h"
+#include "Reinstatement.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+//Year j has j%5 events of growing size
+class LayerTermsTests : public testing::Test{
+	protected:
+	virtual void SetUp() {
+		simulation = VCAPS::Simulation(20000);
+		for (int j = 0; j < 20000; j++){
+			for (int i = 0; i < j % 5; i++)
+				simulation.addVirtualEvent(j, i, VCAPS::VirtualEvent(i, (j % 97) * 100. + i * 1000., 0., "RG1"));
+		}
+	}
+
+	//Straight from the definition of the terms
+	double naive(VCAPS::VirtualYear& year, const VCAPS::Layer& layer) {
+		double ceded = 0;
+		for (VCAPS::VirtualEvent::Iterator iE = year.get_events().begin(); iE != year.get_events().end(); iE++)
+			ceded += min(max(iE->second.loss - layer.occRetention, 0.), layer.occLimit);
+		return layer.share * min(max(ceded - layer.aggDeductible, 0.), layer.aggLimit);
+	}
+	VCAPS::Simulation simulation;
+};
+
+TEST_F(LayerTermsTests, Occurrence_Kernel) {
+	double in[] = {-5, 0, 5, 10, 15, 20, 25, 30, 35};
+	double out[9];
+	VCAPS::LayerTermsEngine::occurrenceTerms(in, out, 9, 10, 15);
+	double expected[] = {0, 0, 0, 0, 5, 10, 15, 15, 15};
+	for (int i = 0; i < 9; i++)
+		EXPECT_EQ(expected[i], out[i]);
+}
+
+TEST_F(LayerTermsTests, Batch_Of_Layers) {
+	vector<VCAPS::Layer> layers(3);
+	layers[0].occRetention = 2000; layers[0].occLimit = 3000;
+	layers[1].occRetention = 500; layers[1].aggDeductible = 1000; layers[1].aggLimit = 8000; layers[1].share = 0.4;
+	layers[2].occRetention = 1e9;
+
+	VCAPS::LayerTermsEngine engine(simulation);
+	vector<VCAPS::AnnualLoss> results;
+	engine.apply(layers, results);
+	ASSERT_EQ(3, (int)results.size());
+	EXPECT_EQ(0, results[2].size());
+
+	for (int l = 0; l < 2; l++){
+		EXPECT_EQ(20000, results[l].get_numIter());
+		for (VCAPS::VirtualYear::Iterator iI = simulation.getIterations().begin(); iI != simulation.getIterations().end(); iI++)
+			EXPECT_DOUBLE_EQ(naive(iI->second, layers[l]), results[l].getAnnualLoss((int)iI->first));
+	}
+}
+
+//Reinstatements paid pro rata as to amount, in sequence order
+TEST_F(LayerTermsTests, Reinstatement_Premiums) {
+	VCAPS::Layer layer;
+	layer.occRetention = 500; layer.occLimit = 1000; layer.aggLimit = 3000;
+	layer.premium = 100;
+	layer.reinstatementRates.push_back(1.0);
+	layer.reinstatementRates.push_back(0.5);
+
+	VCAPS::Simulation gross(10);
+	gross.addVirtualEvent(3, 1, VCAPS::VirtualEvent(1, 1500., 0., "RG1"));
+	gross.addVirtualEvent(3, 2, VCAPS::VirtualEvent(2, 1200., 0., "RG1"));
+	gross.addVirtualEvent(3, 3, VCAPS::VirtualEvent(3, 2000., 0., "RG1"));
+	gross.addVirtualEvent(3, 4, VCAPS::VirtualEvent(4, 2000., 0., "RG1"));
+	gross.addVirtualEvent(5, 1, VCAPS::VirtualEvent(5, 100., 0., "RG1"));
+
+	VCAPS::Simulation ceded = VCAPS::ReinstatementEngine::apply(gross, layer);
+	EXPECT_EQ(10, ceded.get_numIter());
+	ASSERT_EQ(1, (int)ceded.getIterations().size());
+	VCAPS::VirtualYear& year = ceded[3];
+	EXPECT_EQ(4, year.size());
+	double loss[] = {1000, 700, 1000, 300}, rip[] = {100, 35, 15, 0}, fullRip[] = {100, 70, 30, 0};
+	for (int i = 0; i < 4; i++){
+		EXPECT_DOUBLE_EQ(loss[i], year[i + 1].loss);
+		EXPECT_DOUBLE_EQ(rip[i], year[i + 1].reinstatementPrem);
+		EXPECT_DOUBLE_EQ(fullRip[i], year[i + 1].fullRip);
+	}
+
+	//The ceded losses agree with the layer terms engine
+	VCAPS::AnnualLoss annual = VCAPS::LayerTermsEngine(simulation).apply(layer);
+	VCAPS::Simulation cededAll = VCAPS::ReinstatementEngine::apply(simulation, layer);
+	EXPECT_NEAR(annual.get_expected_sd().first, cededAll.get_expected_sd(false).first, 1e-6);
+}
+
+//A table attached from shared memory prices like the simulation it came from
+TEST_F(LayerTermsTests, Shared_Table) {
+	VCAPS::Layer layer;
+	layer.occRetention = 2000; layer.occLimit = 3000; layer.aggLimit = 5000;
+	simulation.scale(1.5, "RG1");
+	VCAPS::EventTable table(simulation);
+
+	VCAPS::EventTable::unpublish("vcaps_layer_terms_test");
+	ASSERT_TRUE(table.publish("vcaps_layer_terms_test"));
+	EXPECT_FALSE(table.publish("vcaps_layer_terms_test"));
+	VCAPS::EventTable attached;
+	ASSERT_TRUE(VCAPS::EventTable::attach("vcaps_layer_terms_test", attached));
+	VCAPS::EventTable::unpublish("vcaps_layer_terms_test");
+	EXPECT_FALSE(VCAPS::EventTable::isPublished("vcaps_layer_terms_test"));
+
+	ASSERT_EQ(table.numEvents(), attached.numEvents());
+	EXPECT_EQ(20000, attached.get_numIter());
+	EXPECT_EQ(1, (int)attached.riskGroups.size());
+	EXPECT_EQ(table.losses[123], attached.losses[123]);
+
+	VCAPS::AnnualLoss expected = VCAPS::LayerTermsEngine(simulation).apply(layer);
+	VCAPS::AnnualLoss shared = VCAPS::LayerTermsEngine(attached).apply(layer);
+	EXPECT_EQ(expected.get_expected_sd().first, shared.get_expected_sd().first);
+	EXPECT_NEAR(simulation.get_expected_sd().first, attached.toSimulation().get_expected_sd().first, 1e-6);
+}
+
+//A saved image whose header does not describe its contents is not loaded
+TEST_F(LayerTermsTests, Corrupt_Image) {
+	const string fileName = "/tmp/vcaps_layer_terms_test.tbl";
+	ASSERT_TRUE(VCAPS::EventTable(simulation).save(fileName));
+	VCAPS::EventTable loaded;
+	ASSERT_TRUE(VCAPS::EventTable::load(fileName, loaded));
+	ifstream in(fileName.c_str(), ios::binary);
+	const string image((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	in.close();
+
+	//header fields: numEvents at 32, losses at 80, riskGroupsSize at 112, size at 120
+	struct Patch { size_t at; uint64_t value; size_t length; } patches[] = {
+		{ 32, (uint64_t)1 << 40, image.size() },
+		{ 80, image.size() - 8, image.size() },
+		{ 80, 3, image.size() },
+		{ 112, 0, image.size() },
+		{ 120, image.size() - 4096, image.size() - 4096 },
+	};
+	for (size_t i = 0; i < sizeof(patches) / sizeof(patches[0]); i++) {
+		string corrupt = image.substr(0, patches[i].length);
+		memcpy(&corrupt[patches[i].at], &patches[i].value, sizeof(uint64_t));
+		ofstream(fileName.c_str(), ios::binary) << corrupt;
+		EXPECT_FALSE(VCAPS::EventTable::load(fileName, loaded)) << "patch " << i;
+	}
+	remove(fileName.c_str());
+}
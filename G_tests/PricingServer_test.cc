@@ -0,0 +1,198 @@
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <future>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "PricingServer.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+//A small simulation file, and a malformed one
+class PricingServerTests : public testing::Test{
+	protected:
+	virtual void SetUp() {
+		ofstream good(goodFile.c_str());
+		good << "_numIter = 1000" << endl << "iterId\tseqId\teventId\tloss\treinstatementPrem\triskGroup" << endl;
+		for (int j = 0; j < 1000; j += 3)
+			good << j << "\t1\t" << j % 7 << "\t" << (j % 11) * 1000. << "\t0\tRG1" << endl;
+		ofstream other(otherFile.c_str());
+		other << "_numIter = 500" << endl << "iterId\tseqId\teventId\tloss\treinstatementPrem\triskGroup" << endl
+			<< "1\t1\t1\t1000\t0\tRG1" << endl;
+		ofstream bad(badFile.c_str());
+		bad << "_numIter = 1000" << endl << "iterId\tseqId\teventId\tloss\treinstatementPrem\triskGroup" << endl
+			<< "1\t1\t1\t1000\t0\tRG1" << endl << "2\t1\tnot a number\t1000\t0\tRG1" << endl;
+		ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	}
+	virtual void TearDown() {
+		close(fds[0]);
+		close(fds[1]);
+		remove(goodFile.c_str());
+		remove(otherFile.c_str());
+		remove(badFile.c_str());
+	}
+
+	string contract(const string& files) {
+		return "C1\t" + files + "\t1000\t5000\t0\t-\t1\t0\t-\n";
+	}
+
+	// a client of the server listening on socketPath
+	int connectTo(const string& socketPath) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+		for (int i = 0; i < 100; i++) {
+			if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0)
+				return fd;
+			usleep(10000);
+		}
+		close(fd);
+		return -1;
+	}
+
+	string goodFile = "/tmp/PricingServer_test_good.txt";
+	string otherFile = "/tmp/PricingServer_test_other.txt";
+	string badFile = "/tmp/PricingServer_test_bad.txt";
+	int fds[2];
+};
+
+TEST_F(PricingServerTests, Frames) {
+	string payload;
+	ASSERT_TRUE(PricingServer::writeFrame(fds[0], "C1\tfile"));
+	ASSERT_TRUE(PricingServer::readFrame(fds[1], payload));
+	EXPECT_EQ("C1\tfile", payload);
+
+	// an empty frame ends a connection, it is read as such
+	ASSERT_TRUE(PricingServer::writeFrame(fds[0], ""));
+	ASSERT_TRUE(PricingServer::readFrame(fds[1], payload));
+	EXPECT_TRUE(payload.empty());
+
+	string large(1 << 20, 'x');
+	thread writer([this, &large]() { PricingServer::writeFrame(fds[0], large); });
+	ASSERT_TRUE(PricingServer::readFrame(fds[1], payload));
+	writer.join();
+	EXPECT_EQ(large, payload);
+}
+
+TEST_F(PricingServerTests, Oversize_And_Short_Frames) {
+	string payload;
+	uint32_t size = htonl(PricingServer::maxFrameSize + 1);
+	ASSERT_EQ((ssize_t)sizeof(size), write(fds[0], &size, sizeof(size)));
+	EXPECT_FALSE(PricingServer::readFrame(fds[1], payload));
+
+	// the peer closes in the middle of a frame
+	size = htonl(10);
+	ASSERT_EQ((ssize_t)sizeof(size), write(fds[0], &size, sizeof(size)));
+	ASSERT_EQ(3, write(fds[0], "abc", 3));
+	shutdown(fds[0], SHUT_WR);
+	EXPECT_FALSE(PricingServer::readFrame(fds[1], payload));
+	EXPECT_FALSE(PricingServer::readFrame(fds[1], payload));
+}
+
+TEST_F(PricingServerTests, Request_Errors) {
+	Pricing pricing;
+	PricingServer server(pricing, "/tmp/PricingServer_test.sock", 1);
+
+	string reply = server.handleRequest(contract(goodFile) + "C2\t" + goodFile + "\t1000\n");
+	EXPECT_EQ(0u, reply.find("error\tline 2: 3 fields instead of 9"));
+	reply = server.handleRequest(contract("/tmp/PricingServer_test_missing.txt"));
+	EXPECT_EQ("error\t/tmp/PricingServer_test_missing.txt not openable\n", reply);
+
+	// the loader fails the request instead of exiting
+	reply = server.handleRequest(contract(badFile));
+	EXPECT_EQ("error\t" + badFile + " not loadable\n", reply);
+	reply = server.handleRequest(contract(goodFile + "+" + otherFile));
+	EXPECT_EQ(0u, reply.find("error\t_numIter 500 of " + otherFile));
+	reply = server.handleRequest(contract("shm:PricingServer_test_unpublished"));
+	EXPECT_EQ(0u, reply.find("error\t"));
+
+	// and keeps serving
+	reply = server.handleRequest("tvar\t0.01\n" + contract(goodFile));
+	EXPECT_EQ(0u, reply.find("ok\ncontractId\texpectedLoss\tsd\texpectedReinstatePrem\tTVaR_0.01\nC1\t"));
+	reply = server.handleRequest(contract(badFile));
+	EXPECT_EQ(0u, reply.find("error\t"));
+}
+
+TEST_F(PricingServerTests, Stop_Before_Run) {
+	Pricing pricing;
+	PricingServer server(pricing, "/tmp/PricingServer_test.sock", 2);
+	server.stop();
+	// returns at once instead of waiting for a connection
+	server.run();
+	thread stopper([&server]() { usleep(100000); server.stop(); });
+	server.run();
+	stopper.join();
+	EXPECT_NE(0, access("/tmp/PricingServer_test.sock", F_OK));
+}
+
+TEST_F(PricingServerTests, Listen_Failure) {
+	Pricing pricing;
+	// fails instead of exiting the process
+	EXPECT_FALSE(PricingServer(pricing, "/tmp/PricingServer_test_missing_dir/test.sock", 1).run());
+	EXPECT_FALSE(PricingServer(pricing, "/tmp/" + string(200, 'x') + ".sock", 1).run());
+}
+
+TEST_F(PricingServerTests, Cold_Load_Does_Not_Block) {
+	Pricing pricing;
+	PricingServer server(pricing, "/tmp/PricingServer_test.sock", 2);
+	string reply = server.handleRequest(contract(goodFile));
+	ASSERT_EQ(0u, reply.find("ok\n"));
+
+	// the read of a fifo waits for its writer, as a long load would
+	string fifo = "/tmp/PricingServer_test_fifo.txt";
+	remove(fifo.c_str());
+	ASSERT_EQ(0, mkfifo(fifo.c_str(), 0600));
+	future<string> cold = async(launch::async, [&]() { return server.handleRequest(contract(fifo)); });
+	usleep(100000);
+	future<string> cached = async(launch::async, [&]() { return server.handleRequest(contract(goodFile)); });
+	bool served = cached.wait_for(chrono::seconds(10)) == future_status::ready;
+	{
+		ofstream writer(fifo.c_str());
+		writer << "_numIter = 1000" << endl << "iterId\tseqId\teventId\tloss\treinstatementPrem\triskGroup" << endl
+			<< "1\t1\t1\t3000\t0\tRG1" << endl;
+	}
+	EXPECT_TRUE(served);
+	EXPECT_EQ(reply, cached.get());
+	EXPECT_EQ(0u, cold.get().find("ok\n"));
+	remove(fifo.c_str());
+}
+
+TEST_F(PricingServerTests, Idle_Clients_And_Oversize_Frames) {
+	Pricing pricing;
+	string socketPath = "/tmp/PricingServer_test_run.sock";
+	PricingServer server(pricing, socketPath, 1);
+	thread running([&server]() { server.run(); });
+
+	// an idle connection does not hold the only worker
+	int idle = connectTo(socketPath), client = connectTo(socketPath);
+	ASSERT_LE(0, idle);
+	ASSERT_LE(0, client);
+	string reply;
+	ASSERT_TRUE(PricingServer::writeFrame(client, contract(goodFile)));
+	ASSERT_TRUE(PricingServer::readFrame(client, reply));
+	EXPECT_EQ(0u, reply.find("ok\n"));
+	ASSERT_TRUE(PricingServer::writeFrame(client, contract(otherFile)));
+	ASSERT_TRUE(PricingServer::readFrame(client, reply));
+	EXPECT_EQ(0u, reply.find("ok\n"));
+	ASSERT_TRUE(PricingServer::writeFrame(idle, contract(goodFile)));
+	ASSERT_TRUE(PricingServer::readFrame(idle, reply));
+	EXPECT_EQ(0u, reply.find("ok\n"));
+
+	// an oversize frame gets an error before the connection is closed
+	uint32_t size = htonl(PricingServer::maxFrameSize + 1);
+	ASSERT_EQ((ssize_t)sizeof(size), write(client, &size, sizeof(size)));
+	ASSERT_TRUE(PricingServer::readFrame(client, reply));
+	EXPECT_EQ(0u, reply.find("error\tframe of "));
+	EXPECT_FALSE(PricingServer::readFrame(client, reply));
+
+	close(idle);
+	close(client);
+	server.stop();
+	running.join();
+}
@@ -0,0 +1,906 @@
+#include <limits.h>
+#include <cmath>
+#include <omp.h>
+#include "Simulation.h"
+#include "SimulationView.h"
+#include "AnnualLoss.h"
+#include "Reduction.h"
+#include "SegmentedSimulation.h"
+#include "EventList.h"
+#include "EventIndex.h"
+#include "TailContribution.h"
+#include "LoadMetrics.h"
+#include "Trace.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include "gtest/gtest.h"
+
+using namespace std;
+
+//Small simulation: year j has j%7 events, every third year is empty
+class SimulationTests : public testing::Test{
+	protected:
+	virtual void SetUp() {
+		simulation = VCAPS::Simulation(30000);
+		for (int j = 0; j < 30000; j += 3){
+			for (int i = 0; i < j % 7; i++){
+				VCAPS::VirtualEvent added_event(i, (j % 101) * 1000.5 + i, i * 0.25, i % 2 ? "RG1" : "RG2");
+				simulation[j].addVirtualEvent(i, added_event, 1.0, j);
+			}
+		}
+	}
+	VCAPS::Simulation simulation;
+};
+
+//Compare against the textbook two-pass formula
+TEST_F(SimulationTests, Expected_SD) {
+	double sum = 0, n = simulation.get_numIter();
+	vector<double> annual;
+	for (VCAPS::VirtualYear::Iterator iI = simulation.getIterations().begin();
+		iI != simulation.getIterations().end(); iI++)
+		annual.push_back(iI->second.GetTotalLoss(true));
+	for (size_t k = 0; k < annual.size(); k++)
+		sum += annual[k];
+	double mean = sum / n, dev = 0;
+	for (size_t k = 0; k < annual.size(); k++)
+		dev += (annual[k] - mean) * (annual[k] - mean);
+	dev += (n - annual.size()) * mean * mean;
+
+	pair<double, double> elsd = simulation.get_expected_sd(true);
+	EXPECT_NEAR(mean, elsd.first, 1e-9 * mean);
+	EXPECT_NEAR(sqrt(dev / n), elsd.second, 1e-9 * elsd.second);
+}
+
+//Deterministic reductions must not depend on the number of threads
+TEST_F(SimulationTests, Deterministic_Reduction) {
+	VCAPS::Reduction::setDeterministic(true);
+	omp_set_num_threads(1);
+	pair<double, double> one = simulation.get_expected_sd();
+	omp_set_num_threads(7);
+	pair<double, double> seven = simulation.get_expected_sd();
+	EXPECT_EQ(one.first, seven.first);
+	EXPECT_EQ(one.second, seven.second);
+
+	VCAPS::AnnualLoss annualLoss(30000);
+	for (int j = 0; j < 30000; j += 2)
+		annualLoss.addAnnualLoss(j, j * 1.5);
+	omp_set_num_threads(1);
+	one = annualLoss.get_expected_sd();
+	omp_set_num_threads(7);
+	seven = annualLoss.get_expected_sd();
+	EXPECT_EQ(one.first, seven.first);
+	EXPECT_EQ(one.second, seven.second);
+	EXPECT_NEAR(22498.5 / 2, one.first, 1e-6);
+}
+
+//EL and SD divide by numIter, also when more years have losses than that
+TEST_F(SimulationTests, More_Years_Than_Iterations) {
+	VCAPS::Simulation sim(3);
+	VCAPS::AnnualLoss annualLoss(3);
+	double losses[] = { 1., 1., 1., 5. };
+	for (int j = 0; j < 4; j++) {
+		sim.addVirtualEvent(j, 1, VCAPS::VirtualEvent(j, losses[j], 0., "RG1"));
+		annualLoss.addAnnualLoss(j, losses[j]);
+	}
+	// sum 8, sum of squares 28 over 3 iterations
+	double mean = 8. / 3, sd = sqrt(28. / 3 - mean * mean);
+	pair<double, double> elsd = sim.get_expected_sd();
+	EXPECT_NEAR(mean, elsd.first, 1e-12);
+	EXPECT_NEAR(sd, elsd.second, 1e-12);
+	elsd = annualLoss.get_expected_sd();
+	EXPECT_NEAR(mean, elsd.first, 1e-12);
+	EXPECT_NEAR(sd, elsd.second, 1e-12);
+	EXPECT_NEAR(annualLoss.get_expectedLoss(), elsd.first, 1e-12);
+}
+
+//A reduction run by one thread of an enclosing team must see all the values
+TEST_F(SimulationTests, Nested_Reduction) {
+	vector<double> x(100000);
+	for (size_t k = 0; k < x.size(); k++)
+		x[k] = (double)(k % 1000);
+	omp_set_num_threads(4);
+	for (int deterministic = 0; deterministic < 2; deterministic++) {
+		VCAPS::Reduction::setDeterministic(deterministic != 0);
+		VCAPS::Moments outside = VCAPS::Reduction::moments(x), inside[4];
+		int team = 0;
+#pragma omp parallel num_threads(4)
+		{
+			inside[omp_get_thread_num()] = VCAPS::Reduction::moments(x);
+#pragma omp master
+			team = omp_get_num_threads();
+		}
+		for (int t = 0; t < team; t++) {
+			EXPECT_EQ(outside.n, inside[t].n);
+			EXPECT_NEAR(outside.mean, inside[t].mean, 1e-9);
+			EXPECT_NEAR(outside.m2, inside[t].m2, 1e-9 * outside.m2);
+		}
+	}
+	VCAPS::Reduction::setDeterministic(true);
+}
+
+//One scan by risk group must match one filtered copy per risk group
+TEST_F(SimulationTests, Aggregate_By_RiskGroup) {
+	map<string, VCAPS::AnnualLoss> byRiskGroup;
+	simulation.aggregateByRiskGroup(byRiskGroup);
+	EXPECT_EQ(2, (int)byRiskGroup.size());
+
+	map<string, VCAPS::EL_SD> elsd;
+	simulation.get_expected_sd(elsd);
+	string rgs[] = {"RG1", "RG2"};
+	for (int k = 0; k < 2; k++){
+		VCAPS::Simulation filtered(simulation, rgs[k], true);
+		pair<double, double> expected = filtered.get_expected_sd();
+		EXPECT_NEAR(expected.first, elsd[rgs[k]].first, 1e-9 * expected.first);
+		EXPECT_NEAR(expected.second, elsd[rgs[k]].second, 1e-9 * expected.second);
+		EXPECT_EQ((int)filtered.getIterations().size(), byRiskGroup[rgs[k]].size());
+	}
+
+	// from one thread of an enclosing team, as in the per-contract loop
+	map<string, VCAPS::AnnualLoss> nested;
+#pragma omp parallel num_threads(2)
+	{
+#pragma omp master
+		simulation.aggregateByRiskGroup(nested);
+	}
+	for (int k = 0; k < 2; k++) {
+		EXPECT_EQ(byRiskGroup[rgs[k]].size(), nested[rgs[k]].size());
+		EXPECT_NEAR(elsd[rgs[k]].first, nested[rgs[k]].get_expected_sd().first, 1e-9 * elsd[rgs[k]].first);
+	}
+}
+
+//A filtered view must give the same results as a filtered copy
+TEST_F(SimulationTests, Filtered_View) {
+	VCAPS::SimulationView rg1(simulation, "RG1", true), notRg1(simulation, "RG1", false);
+	VCAPS::Simulation copyRg1(simulation, "RG1", true), copyNotRg1(simulation, "RG1", false);
+
+	pair<double, double> view = rg1.get_expected_sd(), copy = copyRg1.get_expected_sd();
+	EXPECT_NEAR(copy.first, view.first, 1e-9 * copy.first);
+	EXPECT_NEAR(copy.second, view.second, 1e-9 * copy.second);
+	view = notRg1.get_expected_sd(); copy = copyNotRg1.get_expected_sd();
+	EXPECT_NEAR(copy.first, view.first, 1e-9 * copy.first);
+	EXPECT_NEAR(copy.second, view.second, 1e-9 * copy.second);
+
+	int n = 0;
+	rg1.forEachEvent([&n](VCAPS::VLONG, int, const VCAPS::VirtualEvent& e) {
+		EXPECT_EQ("RG1", e.riskGroup());
+		n++;
+	});
+	EXPECT_EQ(copyRg1.countNumEvents(), n);
+
+	VCAPS::Simulation sum;
+	sum += rg1;
+	EXPECT_EQ(1u, sum.riskGroupMap.size());
+	EXPECT_EQ(1u, sum.riskGroupMap.count("RG1"));
+	sum += notRg1;
+	EXPECT_EQ(2u, sum.riskGroupMap.size());
+	EXPECT_EQ(1u, sum.riskGroupMap.count("RG2"));
+	EXPECT_EQ(simulation.countNumEvents(), sum.countNumEvents());
+	EXPECT_NEAR(simulation.get_expected_sd().first, sum.get_expected_sd().first, 1e-6);
+}
+
+//Copies share the years until one of them is modified
+TEST_F(SimulationTests, Copy_On_Write) {
+	pair<double, double> before = simulation.get_expected_sd();
+	int nEvents = simulation.countNumEvents();
+
+	VCAPS::Simulation copy(simulation);
+	EXPECT_EQ(simulation.getStore(), copy.getStore());
+
+	copy *= 2;
+	copy.addVirtualEvent(1, 1, VCAPS::VirtualEvent(1, 5., 0., "RG3"));
+	EXPECT_NE(simulation.getStore(), copy.getStore());
+	EXPECT_EQ(nEvents + 1, copy.countNumEvents());
+	EXPECT_EQ(nEvents, simulation.countNumEvents());
+	EXPECT_EQ(before.first, simulation.get_expected_sd().first);
+
+	VCAPS::Simulation sum = simulation + simulation;
+	EXPECT_NEAR(2 * before.first, sum.get_expected_sd().first, 1e-9 * before.first);
+	EXPECT_EQ(before.first, simulation.get_expected_sd().first);
+}
+
+//Deferred factors must give the same results as scaling every event
+TEST_F(SimulationTests, Deferred_Factors) {
+	VCAPS::Simulation scaled(simulation), eager(simulation);
+	scaled *= 1.1;
+	scaled.scale(2.0, "RG1");
+	EXPECT_EQ(simulation.getStore(), scaled.getStore());
+
+	int rg1 = VCAPS::RiskGroupTable::intern("RG1");
+	for (VCAPS::VirtualYear::Iterator iI = eager.getIterations().begin(); iI != eager.getIterations().end(); iI++){
+		for (VCAPS::VirtualEvent::Iterator iE = iI->second.get_events().begin(); iE != iI->second.get_events().end(); iE++){
+			iE->second *= 1.1;
+			iE->second.scale(2.0, rg1);
+		}
+	}
+	pair<double, double> expected = eager.get_expected_sd();
+	pair<double, double> lazy = scaled.get_expected_sd();
+	EXPECT_NEAR(expected.first, lazy.first, 1e-9 * expected.first);
+	EXPECT_NEAR(expected.second, lazy.second, 1e-9 * expected.second);
+
+	map<string, VCAPS::EL_SD> eagerByRG, lazyByRG;
+	eager.get_expected_sd(eagerByRG);
+	scaled.get_expected_sd(lazyByRG);
+	EXPECT_NEAR(eagerByRG["RG1"].first, lazyByRG["RG1"].first, 1e-9 * eagerByRG["RG1"].first);
+	EXPECT_NEAR(expected.first, VCAPS::SimulationView(scaled, "NONE", false).get_expected_sd().first, 1e-9 * expected.first);
+
+	scaled.materialize();
+	EXPECT_TRUE(scaled.get_factors().identity());
+	EXPECT_NEAR(expected.first, scaled.get_expected_sd().first, 1e-9 * expected.first);
+	EXPECT_NE(simulation.getStore(), scaled.getStore());
+}
+
+//Tail measures over the years of a 1-in-n table, zero years included
+TEST_F(SimulationTests, Quantile_TVaR) {
+	VCAPS::AnnualLoss annualLoss(1000);
+	for (int j = 1; j <= 100; j++)
+		annualLoss.addAnnualLoss(j, j * 10.);
+	EXPECT_DOUBLE_EQ(1000., annualLoss.getQuantile(0.001));
+	EXPECT_DOUBLE_EQ(910., annualLoss.getQuantile(0.01));
+	EXPECT_DOUBLE_EQ(955., annualLoss.getTVaR(0.01));
+	EXPECT_DOUBLE_EQ(0., annualLoss.getQuantile(0.5));
+	EXPECT_DOUBLE_EQ(101., annualLoss.getTVaR(0.5));
+}
+
+//Concurrent queries on one instance must agree with serial ones
+TEST_F(SimulationTests, Concurrent_Queries) {
+	VCAPS::AnnualLoss portfolio(30000);
+	vector<VCAPS::AnnualLoss> contracts(16, VCAPS::AnnualLoss(30000));
+	for (int j = 0; j < 30000; j++){
+		portfolio.addAnnualLoss(j, (j * 7919) % 10007);
+		for (int c = 0; c < 16; c++)
+			if ((j + c) % 3 == 0)
+				contracts[c].addAnnualLoss(j, (j * (c + 3)) % 101);
+	}
+	vector<double> probs(1, 0.01);
+	probs.push_back(0.004);
+
+	VCAPS::AnnualLoss serial(portfolio);
+	vector<double> expected(16), allocated(16), tvars(16);
+	for (int c = 0; c < 16; c++)
+		expected[c] = serial.getAllocatedTVaRSeries(contracts[c], probs);
+
+	simulation.scale(1.5, "RG1");
+	simulation.freeze();
+	EXPECT_TRUE(simulation.get_factors().identity());
+	const VCAPS::Simulation& frozen = simulation;
+	pair<double, double> elsd = frozen.get_expected_sd();
+	vector<double> els(16);
+#pragma omp parallel for num_threads(8)
+	for (int c = 0; c < 16; c++){
+		allocated[c] = portfolio.getAllocatedTVaRSeries(contracts[c], probs);
+		tvars[c] = portfolio.getTVaR(0.01);
+		els[c] = frozen.get_expected_sd().first;
+	}
+	for (int c = 0; c < 16; c++){
+		EXPECT_DOUBLE_EQ(expected[c], allocated[c]);
+		EXPECT_EQ(serial.getTVaR(0.01), tvars[c]);
+		EXPECT_EQ(elsd.first, els[c]);
+	}
+}
+
+//Streaming over on-disk segments must match the in-memory aggregates
+TEST_F(SimulationTests, Segmented_Simulation) {
+	string file = "/tmp/Simulation_test_yelt.txt", directory = "/tmp/Simulation_test_segments";
+	{
+		ofstream out(file.c_str());
+		out << "_numIter = 30000" << endl << "iterId\tseqId\teventId\tloss\treinstatementPrem\triskGroup" << endl;
+		out.precision(17);
+		for (VCAPS::VirtualYear::ConstIterator iI = simulation.getIterations().begin(); iI != simulation.getIterations().end(); iI++)
+			for (VCAPS::VirtualEvent::ConstIterator iE = iI->second.get_events().begin(); iE != iI->second.get_events().end(); iE++)
+				out << iI->first << "\t" << iE->first << "\t" << iE->second.eventId() << "\t" << iE->second.loss
+					<< "\t" << iE->second.reinstatementPrem << "\t" << iE->second.riskGroup() << endl;
+	}
+	VCAPS::SegmentedSimulation segmented;
+	ASSERT_TRUE(segmented.partition(file, directory, 256 << 10));
+	EXPECT_LT(1, segmented.numSegments());
+	VCAPS::SegmentedSimulation reopened;
+	ASSERT_TRUE(reopened.open(directory));
+	EXPECT_EQ(segmented.numSegments(), reopened.numSegments());
+
+	pair<double, double> expected = simulation.get_expected_sd(true), streamed;
+	ASSERT_TRUE(reopened.get_expected_sd(streamed, true));
+	EXPECT_NEAR(expected.first, streamed.first, 1e-9 * expected.first);
+	EXPECT_NEAR(expected.second, streamed.second, 1e-9 * expected.second);
+
+	map<string, VCAPS::EL_SD> expectedByRG, streamedByRG;
+	simulation.get_expected_sd(expectedByRG);
+	ASSERT_TRUE(reopened.get_expected_sd(streamedByRG));
+	ASSERT_EQ(expectedByRG.size(), streamedByRG.size());
+	EXPECT_NEAR(expectedByRG["RG2"].second, streamedByRG["RG2"].second, 1e-9 * expectedByRG["RG2"].second);
+
+	vector<VCAPS::Layer> layers(2);
+	layers[0].occRetention = 20000; layers[1].occLimit = 50000; layers[1].aggLimit = 120000;
+	vector<VCAPS::AnnualLoss> inMemory, fromDisk;
+	VCAPS::LayerTermsEngine(simulation).apply(layers, inMemory);
+	ASSERT_TRUE(reopened.applyLayers(layers, fromDisk));
+	for (int l = 0; l < 2; l++){
+		EXPECT_EQ(inMemory[l].size(), fromDisk[l].size());
+		EXPECT_NEAR(inMemory[l].get_expected_sd().first, fromDisk[l].get_expected_sd().first, 1e-6);
+	}
+	for (int k = 0; k < reopened.numSegments(); k++){
+		stringstream segment;
+		segment << directory << "/segment_" << k << ".evt";
+		remove(segment.str().c_str());
+	}
+
+	// a budget asking for a segment per year stays below the open file limit
+	VCAPS::SegmentedSimulation capped;
+	ASSERT_TRUE(capped.partition(file, directory, 1));
+	EXPECT_GE((int)VCAPS::SegmentedSimulation::maxOpenSegments, capped.numSegments());
+	ASSERT_TRUE(capped.get_expected_sd(streamed, true));
+	EXPECT_NEAR(expected.first, streamed.first, 1e-9 * expected.first);
+	remove(file.c_str());
+	for (int k = 0; k < capped.numSegments(); k++){
+		stringstream segment;
+		segment << directory << "/segment_" << k << ".evt";
+		remove(segment.str().c_str());
+	}
+
+	// a segment gone fails the aggregates instead of exiting
+	map<string, VCAPS::AnnualLoss> byRG;
+	EXPECT_FALSE(capped.get_expected_sd(streamed, true));
+	EXPECT_FALSE(capped.aggregateByRiskGroup(byRG));
+	EXPECT_FALSE(capped.applyLayers(layers, fromDisk));
+	remove((directory + "/segments.txt").c_str());
+
+	// the rows the loader of Simulation rejects are rejected
+	const char* bad[] = { "1\t1\tx\t1000\t0\tRG1", "1\t1\t1\t1000", "1\t1\t1\t1000\t0\tRG1\t5",
+	                      "30000\t1\t1\t1000\t0\tRG1", "-1\t1\t1\t1000\t0\tRG1" };
+	for (int i = 0; i < 5; i++) {
+		{
+			ofstream out(file.c_str());
+			out << "_numIter = 30000" << endl << "iterId\tseqId\teventId\tloss\treinstatementPrem\triskGroup" << endl
+				<< "2\t1\t1\t500\t0\tRG1" << endl << bad[i] << endl;
+		}
+		VCAPS::SegmentedSimulation rejected;
+		EXPECT_FALSE(rejected.partition(file, directory, 256 << 10)) << bad[i];
+		EXPECT_FALSE(rejected.open(directory));
+	}
+	remove(file.c_str());
+	rmdir(directory.c_str());
+}
+
+//Iteration ids and counts beyond 32 bits are kept as they are
+TEST_F(SimulationTests, Large_Iteration_Ids) {
+	VCAPS::VLONG numIter = 5000000000LL, big = 4000000000LL;
+	VCAPS::Simulation large(numIter);
+	large[big].addVirtualEvent(1, VCAPS::VirtualEvent(1, 5e9, 0., "RG1"), 1.0, big);
+	large.addVirtualEvent((3LL << 32) | 7, 1, VCAPS::VirtualEvent(2, 5e9, 0., "RG1"));
+	EXPECT_EQ(numIter, large.get_numIter());
+	EXPECT_EQ(2, (int)large.getIterations().size());
+	EXPECT_NEAR(2.0, large.get_expected_sd().first, 1e-12);
+
+	map<string, VCAPS::AnnualLoss> byRiskGroup;
+	large.aggregateByRiskGroup(byRiskGroup);
+	EXPECT_EQ(5e9, byRiskGroup["RG1"].getAnnualLoss(big));
+	EXPECT_EQ(5e9, byRiskGroup["RG1"].getAnnualLoss((3LL << 32) | 7));
+	EXPECT_EQ(0., byRiskGroup["RG1"].getAnnualLoss(7));
+	EXPECT_EQ(numIter, byRiskGroup["RG1"].get_numIter());
+	EXPECT_EQ(5e9, byRiskGroup["RG1"].getQuantile(1.0 / numIter));
+}
+
+//ignoring the ordering the flat event list aggregates as the one-event years
+TEST_F(SimulationTests, Event_List) {
+	string file = "/tmp/Simulation_test_events.txt";
+	{
+		ofstream out(file.c_str());
+		out << "_numIter = 30000" << endl << "iterId\tseqId\teventId\tloss\treinstatementPrem\triskGroup" << endl;
+		out.precision(17);
+		for (VCAPS::VirtualYear::ConstIterator iI = simulation.getIterations().begin(); iI != simulation.getIterations().end(); iI++)
+			for (VCAPS::VirtualEvent::ConstIterator iE = iI->second.get_events().begin(); iE != iI->second.get_events().end(); iE++)
+				out << iI->first << "\t" << iE->first << "\t" << iE->second.eventId() << "\t" << iE->second.loss
+					<< "\t" << iE->second.reinstatementPrem << "\t" << iE->second.riskGroup() << endl;
+	}
+	VCAPS::Simulation years;
+	years.readFromFile(file, 0, "", true);
+	VCAPS::EventList events;
+	events.readFromFile(file, 0, "");
+	VCAPS::Simulation ordered;
+	ordered.readFromFile(file, 0, "");
+	remove(file.c_str());
+	EXPECT_EQ(simulation.countNumEvents(), ordered.countNumEvents());
+	EXPECT_EQ(simulation.countNumEvents("RG2"), ordered.countNumEvents("RG2"));
+
+	const VCAPS::LoadMetrics& metrics = VCAPS::LoadMetrics::last();
+	long parsed = 0;
+	for (size_t t = 0; t < metrics.threads.size(); t++)
+		parsed += metrics.threads[t].rowsParsed;
+	EXPECT_EQ((long)events.size(), parsed);
+	EXPECT_LT(0u, metrics.bytesRead);
+	EXPECT_EQ('{', metrics.json()[0]);
+
+	EXPECT_EQ(simulation.countNumEvents(), (int)events.size());
+	for (size_t k = 1; k < events.size(); k++)
+		ASSERT_LT(events.key(k - 1), events.key(k));
+
+	// the aggregates of the Simulation read ignoring the ordering run on
+	//  its rows until its years are needed
+	VCAPS::Simulation expanded = events.toSimulation(), scaled(years);
+	pair<double, double> expected = expanded.get_expected_sd(true), flat = events.get_expected_sd(true),
+		unexpanded = years.get_expected_sd(true);
+	EXPECT_NEAR(expected.first, flat.first, 1e-9 * expected.first);
+	EXPECT_NEAR(expected.second, flat.second, 1e-9 * expected.second);
+	EXPECT_EQ(flat, unexpanded);
+	scaled *= 2.;
+	EXPECT_NEAR(2. * expected.first, scaled.get_expected_sd(true).first, 1e-9 * expected.first);
+
+	map<string, VCAPS::AnnualLoss> expectedByRG, flatByRG, unexpandedByRG;
+	expanded.aggregateByRiskGroup(expectedByRG);
+	events.aggregateByRiskGroup(flatByRG);
+	years.aggregateByRiskGroup(unexpandedByRG);
+	ASSERT_EQ(expectedByRG.size(), flatByRG.size());
+	ASSERT_EQ(expectedByRG.size(), unexpandedByRG.size());
+	for (map<string, VCAPS::AnnualLoss>::iterator i = expectedByRG.begin(); i != expectedByRG.end(); i++) {
+		EXPECT_TRUE(i->second.get_annualLoss() == flatByRG[i->first].get_annualLoss());
+		EXPECT_TRUE(i->second.get_annualLoss() == unexpandedByRG[i->first].get_annualLoss());
+	}
+
+	// the years are built when asked for
+	EXPECT_EQ(expanded.countNumEvents(), years.countNumEvents());
+	EXPECT_EQ(years.countNumEvents(), (int)years.getIterations().size());
+	scaled.scale(0.5, "ALL");
+	scaled.scale(3., "RG1");
+	VCAPS::Simulation rg1(years, "RG1", true);
+	EXPECT_NEAR(expected.first + 2. * rg1.get_expected_sd(true).first, scaled.get_expected_sd(true).first,
+	            1e-9 * expected.first);
+	scaled += years;
+	EXPECT_EQ(years.countNumYears(), scaled.countNumYears());
+}
+
+//The rows of one (iteration, sequence), e.g. split by risk group, are one year
+TEST_F(SimulationTests, Event_List_Duplicate_Keys) {
+	string file = "/tmp/Simulation_test_duplicates.txt";
+	{
+		ofstream out(file.c_str());
+		out << "_numIter = 10" << endl << "iterId\tseqId\teventId\tloss\treinstatementPrem\triskGroup" << endl
+			<< "1\t1\t5\t100\t0\tRG1" << endl << "1\t1\t5\t50\t0\tRG2" << endl
+			<< "2\t1\t6\t30\t0\tRG1" << endl << "2\t2\t7\t20\t0\tRG1" << endl;
+	}
+	VCAPS::EventList events;
+	events.readFromFile(file, 0, "");
+	VCAPS::Simulation years;
+	years.readFromFile(file, 0, "", true);
+	remove(file.c_str());
+	ASSERT_EQ(4u, events.size());
+
+	// years of 150, 30 and 20 and seven zero years
+	pair<double, double> flat = events.get_expected_sd(true);
+	EXPECT_NEAR(20., flat.first, 1e-9);
+	EXPECT_NEAR(sqrt(1980.), flat.second, 1e-9);
+	EXPECT_EQ(flat, years.get_expected_sd(true));
+	pair<double, double> expanded = events.toSimulation().get_expected_sd(true);
+	EXPECT_NEAR(expanded.first, flat.first, 1e-9);
+	EXPECT_NEAR(expanded.second, flat.second, 1e-9);
+}
+
+//Several events per iteration are more keys than iterations, the EL is
+//still the total loss / numIter
+TEST_F(SimulationTests, Event_List_Events_Per_Iteration) {
+	string file = "/tmp/Simulation_test_per_iteration.txt";
+	double total = 0;
+	{
+		ofstream out(file.c_str());
+		out << "_numIter = 100" << endl << "iterId\tseqId\teventId\tloss\treinstatementPrem\triskGroup" << endl;
+		for (int j = 0; j < 100; j++)
+			for (int i = 0; i < 10; i++) {
+				out << j << "\t" << i << "\t" << i << "\t" << (j % 7) * 10 + i << "\t0\tRG1" << endl;
+				total += (j % 7) * 10 + i;
+			}
+	}
+	VCAPS::EventList events;
+	events.readFromFile(file, 0, "");
+	VCAPS::Simulation years;
+	years.readFromFile(file, 0, "", true);
+	remove(file.c_str());
+	ASSERT_EQ(1000u, events.size());
+
+	pair<double, double> flat = events.get_expected_sd(true);
+	EXPECT_NEAR(total / 100, flat.first, 1e-9);
+	EXPECT_EQ(flat, years.get_expected_sd(true));
+	pair<double, double> expanded = events.toSimulation().get_expected_sd(true);
+	EXPECT_NEAR(expanded.first, flat.first, 1e-9);
+	EXPECT_NEAR(expanded.second, flat.second, 1e-9);
+}
+
+//The loader metrics are measured on every thread, and kept off cout
+TEST_F(SimulationTests, Load_Metrics) {
+	string file = "/tmp/Simulation_test_metrics.txt";
+	{
+		ofstream out(file.c_str());
+		out << "_numIter = 30000" << endl << "iterId\tseqId\teventId\tloss\treinstatementPrem\triskGroup" << endl;
+		for (int j = 0; j < 200000; j++)
+			out << j % 30000 << "\t" << j << "\t" << j % 97 << "\t" << (j % 13) * 100. << "\t0\tRG" << j % 3 << endl;
+	}
+	stringstream report;
+	VCAPS::LoadMetrics::sink() = &report;
+	VCAPS::EventList events;
+	events.readFromFile(file, 100, "");
+	VCAPS::LoadMetrics::sink() = &cerr;
+	remove(file.c_str());
+
+	const VCAPS::LoadMetrics& metrics = VCAPS::LoadMetrics::last();
+	long parsed = 0;
+	for (size_t t = 0; t < metrics.threads.size(); t++) {
+		const VCAPS::LoadMetrics::Thread& m = metrics.threads[t];
+		parsed += m.rowsParsed;
+		if (m.rowsKept > 0) {
+			EXPECT_LT(0., m.parseMs);
+			EXPECT_LT(0., m.insertMs);
+		}
+	}
+	EXPECT_EQ(200000, parsed);
+	EXPECT_EQ(0u, report.str().find("loader metrics: {"));
+	// I/O is reported for the whole load only
+	size_t io = report.str().find("\"ioMs\"");
+	EXPECT_NE(string::npos, io);
+	EXPECT_EQ(string::npos, report.str().find("\"ioMs\"", io + 1));
+}
+
+//The event counts follow the additions, merges and filters
+TEST_F(SimulationTests, Event_Counts) {
+	VCAPS::VLONG nEvents = 0, nRG1 = 0;
+	for (VCAPS::VirtualYear::ConstIterator iI = simulation.getIterations().begin(); iI != simulation.getIterations().end(); iI++)
+		for (VCAPS::VirtualEvent::ConstIterator iE = iI->second.get_events().begin(); iE != iI->second.get_events().end(); iE++) {
+			nEvents++;
+			nRG1 += iE->second.riskGroup() == "RG1";
+		}
+	EXPECT_EQ(nEvents, simulation.countNumEvents());
+	EXPECT_EQ(nRG1, simulation.countNumEvents("RG1"));
+	EXPECT_EQ((VCAPS::VLONG)simulation.getIterations().size(), simulation.countNumYears());
+
+	VCAPS::Simulation rg1(simulation, "RG1", true), notRg1(simulation, "RG1", false);
+	EXPECT_EQ(nRG1, rg1.countNumEvents());
+	EXPECT_EQ(nEvents - nRG1, notRg1.countNumEvents());
+	EXPECT_EQ(0, notRg1.countNumEvents("RG1"));
+
+	VCAPS::Simulation sum(rg1);
+	sum += notRg1;
+	EXPECT_EQ(nEvents, sum.countNumEvents());
+	EXPECT_EQ(nRG1, sum.countNumEvents("RG1"));
+	sum += notRg1;
+	EXPECT_EQ(nEvents, sum.countNumEvents());
+	sum -= rg1;
+	EXPECT_EQ(nEvents, sum.countNumEvents());
+
+	sum.addVirtualEvent(1, 1000001, VCAPS::VirtualEvent(7, 5., 0., "RG1"));
+	EXPECT_EQ(nEvents + 1, sum.countNumEvents());
+	EXPECT_EQ(nRG1 + 1, sum.countNumEvents("RG1"));
+	sum.getIterations()[1].addVirtualEvent(1000002, VCAPS::VirtualEvent(7, 5., 0., "RG1"), 1.0, 1);
+	EXPECT_EQ(nEvents + 2, sum.countNumEvents());
+	EXPECT_EQ(nEvents, simulation.countNumEvents());
+}
+
+//A Simulation combined with itself, its pending factors on both sides
+TEST_F(SimulationTests, Combine_Self) {
+	double before = simulation.get_expected_sd().first;
+	VCAPS::Simulation doubled(simulation), cancelled(simulation), moved(simulation);
+	doubled *= 2.;
+	doubled += doubled;
+	EXPECT_NEAR(4. * before, doubled.get_expected_sd().first, 1e-9 * before);
+	cancelled *= 2.;
+	cancelled.scale(3., "RG1");
+	cancelled -= cancelled;
+	EXPECT_NEAR(0., cancelled.get_expected_sd().first, 1e-9 * before);
+	moved *= 2.;
+	moved += std::move(moved);
+	EXPECT_NEAR(4. * before, moved.get_expected_sd().first, 1e-9 * before);
+	EXPECT_EQ(before, simulation.get_expected_sd().first);
+}
+
+TEST_F(SimulationTests, Combine_Moved) {
+	VCAPS::Simulation rg1(simulation, "RG1", true), other(simulation, "RG1", false);
+	VCAPS::Simulation copied(rg1);
+	copied.scale(2., "RG1");
+	copied += other;
+	VCAPS::Simulation moved(rg1), otherCopy(simulation, "RG1", false);
+	moved.scale(2., "RG1");
+	moved += std::move(otherCopy);
+	EXPECT_TRUE(otherCopy.empty());
+	EXPECT_EQ(copied.countNumEvents(), moved.countNumEvents());
+	EXPECT_EQ(copied.countNumYears(), moved.countNumYears());
+	pair<double, double> a = copied.get_expected_sd(), b = moved.get_expected_sd();
+	EXPECT_NEAR(a.first, b.first, 1e-6 * fabs(a.first));
+	EXPECT_NEAR(a.second, b.second, 1e-6 * fabs(a.second));
+
+	// years only on the right are moved in negated
+	VCAPS::Simulation lessCopied(rg1), lessMoved(rg1), scaled(other);
+	scaled *= 3.;
+	lessCopied -= scaled;
+	lessMoved -= std::move(scaled);
+	EXPECT_EQ(lessCopied.countNumEvents(), lessMoved.countNumEvents());
+	a = lessCopied.get_expected_sd();
+	b = lessMoved.get_expected_sd();
+	EXPECT_NEAR(a.first, b.first, 1e-6 * fabs(a.first));
+	EXPECT_NEAR(a.second, b.second, 1e-6 * fabs(a.second));
+	EXPECT_NEAR(rg1.get_expected_sd().first - 3. * other.get_expected_sd().first, a.first, 1e-6 * fabs(a.first));
+
+	// a shared store is copied from, not moved
+	VCAPS::Simulation shared(other), sum(rg1);
+	sum += std::move(shared);
+	EXPECT_TRUE(shared.empty());
+	EXPECT_EQ(simulation.countNumEvents(), sum.countNumEvents());
+	EXPECT_EQ(simulation.countNumEvents() - rg1.countNumEvents(), other.countNumEvents());
+}
+
+TEST_F(SimulationTests, Event_Catalog) {
+	VCAPS::VirtualEvent a(42, 1., 0., "RG1"), b(42, 2., 0., "RG1"), c(42, 3., 0., "RG2");
+	EXPECT_EQ(a.catalogId, b.catalogId);
+	EXPECT_NE(a.catalogId, c.catalogId);
+	EXPECT_EQ(42, c.eventId());
+	EXPECT_EQ("RG2", c.riskGroup());
+	EXPECT_EQ(VCAPS::RiskGroupTable::intern("RG2"), c.rgId());
+	EXPECT_EQ(a.catalogId, VCAPS::EventCatalog::intern(42, "RG1"));
+	EXPECT_GT(VCAPS::EventCatalog::size(), c.catalogId);
+
+	// the events of the loaded years share their catalog entries
+	const VCAPS::VirtualYear::MAP& iters = simulation.getIterations();
+	for (VCAPS::VirtualYear::ConstIterator iI = iters.begin(); iI != iters.end(); iI++)
+		for (VCAPS::VirtualEvent::ConstIterator iE = iI->second.get_events().begin(); iE != iI->second.get_events().end(); iE++)
+			EXPECT_EQ(iE->second.catalogId, VCAPS::EventCatalog::intern(iE->second.eventId(), iE->second.riskGroup()));
+
+	VCAPS::VirtualEvent d = VCAPS::VirtualEvent::cataloged(c.catalogId, 4., 1., 0.5);
+	EXPECT_EQ(42, d.eventId());
+	EXPECT_EQ("RG2", d.riskGroup());
+	EXPECT_NEAR(4., d.loss, 1e-12);
+	EXPECT_FALSE(d.noncat());
+
+	// the default event is event 0 of NA
+	VCAPS::VirtualEvent e;
+	EXPECT_EQ(VCAPS::EventCatalog::intern(0, "NA"), e.catalogId);
+	EXPECT_EQ("NA", e.riskGroup());
+
+	// an event interned once the catalog was full is not added
+	VCAPS::Simulation sim(10);
+	EXPECT_FALSE(sim.addVirtualEvent(1, 1, VCAPS::VirtualEvent::cataloged(-1, 4., 1., 0.5)));
+	EXPECT_EQ(0, sim.countNumEvents());
+}
+
+TEST_F(SimulationTests, Event_Index) {
+	VCAPS::Simulation scaled(simulation);
+	scaled.scale(2., "RG1");
+	VCAPS::EventIndex index(scaled);
+	EXPECT_EQ((size_t)scaled.countNumEvents(), index.size());
+
+	// a full scan for an event that occurs in the simulation
+	const VCAPS::VirtualYear::MAP& iters = simulation.getIterations();
+	int eventId = iters.begin()->second.get_events().begin()->second.eventId();
+	vector<VCAPS::VLONG> years;
+	vector<pair<double, VCAPS::VLONG> > annualLosses;
+	double total = 0;
+	for (VCAPS::VirtualYear::ConstIterator iI = iters.begin(); iI != iters.end(); iI++) {
+		double annualLoss = 0;
+		for (VCAPS::VirtualEvent::ConstIterator iE = iI->second.get_events().begin(); iE != iI->second.get_events().end(); iE++) {
+			double loss = iE->second.get_lossNetOfReinstatePrem() * (iE->second.riskGroup() == "RG1" ? 2. : 1.);
+			annualLoss += loss;
+			if (iE->second.eventId() != eventId)
+				continue;
+			total += loss;
+			if (years.empty() || years.back() != iI->first)
+				years.push_back(iI->first);
+		}
+		annualLosses.push_back(make_pair(-annualLoss, iI->first));
+	}
+	EXPECT_EQ(years, index.years(eventId));
+	EXPECT_NEAR(total, index.totalLoss(eventId), 1e-9 * fabs(total));
+
+	sort(annualLosses.begin(), annualLosses.end());
+	size_t topN = 300;
+	set<VCAPS::VLONG> top;
+	for (size_t r = 0; r < topN; r++)
+		top.insert(annualLosses[r].second);
+	size_t inTop = 0;
+	VCAPS::EventIndex::RANGE range = index.find(eventId);
+	for (const VCAPS::EventIndex::Occurrence* o = range.first; o != range.second; o++) {
+		EXPECT_EQ(eventId, o->eventId);
+		inTop += top.count(o->iterId);
+	}
+	EXPECT_EQ(inTop, index.occurrencesInTop(eventId, topN));
+	EXPECT_LE(index.lossInTop(eventId, topN), index.totalLoss(eventId) + 1e-9);
+	EXPECT_EQ(index.occurrencesInTop(eventId, (size_t)scaled.get_numIter()), (size_t)(range.second - range.first));
+
+	EXPECT_TRUE(index.years(-12345).empty());
+	EXPECT_EQ(0., index.totalLoss(-12345));
+}
+
+TEST_F(SimulationTests, Tail_Contributions) {
+	VCAPS::Simulation scaled(simulation);
+	scaled.scale(2., "RG1");
+	map<string, VCAPS::AnnualLoss> byRiskGroup;
+	scaled.aggregateByRiskGroup(byRiskGroup);
+	VCAPS::AnnualLoss total(byRiskGroup["RG1"]);
+	total.addAnnualLoss(byRiskGroup["RG2"]);
+
+	vector<double> probs;
+	probs.push_back(0.01);
+	probs.push_back(0.004);
+	probs.push_back(0.1);
+	vector<VCAPS::TailContributionEngine::Result> results = VCAPS::TailContributionEngine::compute(scaled, probs);
+	ASSERT_EQ(probs.size(), results.size());
+	VCAPS::EventIndex index(scaled);
+	for (size_t j = 0; j < probs.size(); j++) {
+		const VCAPS::TailContributionEngine::Result& result = results[j];
+		double tvar = total.getTVaR(probs[j]);
+		EXPECT_EQ(probs[j], result.prob);
+		EXPECT_NEAR(tvar, result.tvar, 1e-9 * fabs(tvar));
+
+		double sumEvents = 0, sumGroups = 0;
+		for (unordered_map<int, double>::const_iterator i = result.byEvent.begin(); i != result.byEvent.end(); i++)
+			sumEvents += i->second;
+		for (map<string, double>::const_iterator i = result.byRiskGroup.begin(); i != result.byRiskGroup.end(); i++)
+			sumGroups += i->second;
+		EXPECT_NEAR(tvar, sumEvents, 1e-9 * fabs(tvar));
+		EXPECT_NEAR(tvar, sumGroups, 1e-9 * fabs(tvar));
+
+		// RG1's losses in the largest years of the total
+		vector<pair<double, VCAPS::VLONG> > sorted;
+		for (VCAPS::AnnualLoss::MAP::const_iterator i = total.get_annualLoss().begin(); i != total.get_annualLoss().end(); i++)
+			sorted.push_back(make_pair(-i->second, i->first));
+		sort(sorted.begin(), sorted.end());
+		double rg1 = 0;
+		for (VCAPS::VLONG r = 0; r < result.tailYears; r++)
+			rg1 += byRiskGroup["RG1"].getAnnualLoss(sorted[r].second);
+		EXPECT_NEAR(rg1 / result.tailYears, result.byRiskGroup.at("RG1"), 1e-9 * fabs(tvar));
+
+		// the tail years are the top years of the index
+		const VCAPS::VirtualEvent& e = scaled.getIterations().begin()->second.get_events().begin()->second;
+		unordered_map<int, double>::const_iterator iE = result.byEvent.find(e.eventId());
+		double expected = index.lossInTop(e.eventId(), (size_t)result.tailYears) / result.tailYears;
+		EXPECT_NEAR(expected, iE == result.byEvent.end() ? 0. : iE->second, 1e-9 * fabs(tvar));
+	}
+	EXPECT_EQ(120, results[1].tailYears);
+	EXPECT_LE(results[1].byEvent.size(), results[0].byEvent.size());
+}
+
+//The top years of the index are the tail of the contributions when years
+//have no events, zero or negative losses
+TEST_F(SimulationTests, Event_Index_Tail) {
+	VCAPS::Simulation sim(1000);
+	for (int j = 0; j < 600; j++) {
+		sim.addVirtualEvent(j, 1, VCAPS::VirtualEvent(j % 7, ((j * 37) % 23 - 8) * 100., 0., "RG1"));
+		if (j % 10 == 0) {
+			sim.addVirtualEvent(j, 2, VCAPS::VirtualEvent(100 + j % 3, 500., 0., "RG2"));
+			sim.addVirtualEvent(j, 3, VCAPS::VirtualEvent(200, -500. - ((j * 37) % 23 - 8) * 100., 0., "RG2"));
+		}
+	}
+
+	vector<double> probs;
+	probs.push_back(0.1);
+	probs.push_back(0.45);
+	probs.push_back(0.8);
+	probs.push_back(0.99);
+	vector<VCAPS::TailContributionEngine::Result> results = VCAPS::TailContributionEngine::compute(sim, probs);
+	VCAPS::EventIndex index(sim);
+	int eventIds[] = { 0, 1, 2, 3, 4, 5, 6, 100, 101, 102, 200 };
+	for (size_t j = 0; j < probs.size(); j++) {
+		const VCAPS::TailContributionEngine::Result& result = results[j];
+		size_t n = (size_t)result.tailYears;
+		for (size_t i = 0; i < sizeof(eventIds) / sizeof(eventIds[0]); i++) {
+			unordered_map<int, double>::const_iterator iE = result.byEvent.find(eventIds[i]);
+			EXPECT_EQ(iE != result.byEvent.end(), index.occurrencesInTop(eventIds[i], n) > 0)
+				<< "event " << eventIds[i] << " prob " << probs[j];
+			EXPECT_NEAR(iE == result.byEvent.end() ? 0. : iE->second, index.lossInTop(eventIds[i], n) / n, 1e-9)
+				<< "event " << eventIds[i] << " prob " << probs[j];
+		}
+	}
+	// the negative years rank after the 400 iterations without events
+	EXPECT_EQ(index.occurrencesInTop(0, 1000), index.occurrencesInTop(0, 2000));
+	EXPECT_LT(index.occurrencesInTop(0, 600), index.occurrencesInTop(0, 1000));
+}
+
+//With more years than iterations there are no zero years in the tail
+TEST_F(SimulationTests, Tail_More_Years_Than_Iterations) {
+	VCAPS::Simulation sim(3);
+	VCAPS::AnnualLoss annualLoss(3);
+	double losses[] = { 5., -1., -2., -3. };
+	for (int j = 0; j < 4; j++) {
+		sim.addVirtualEvent(j, 1, VCAPS::VirtualEvent(j, losses[j], 0., "RG1"));
+		annualLoss.addAnnualLoss(j, losses[j]);
+	}
+	// the tail of 2 years is 5 and -1
+	EXPECT_NEAR(2., annualLoss.getTVaR(0.67), 1e-12);
+	EXPECT_NEAR(-1., annualLoss.getQuantile(0.67), 1e-12);
+	vector<double> probs(1, 0.67);
+	vector<VCAPS::TailContributionEngine::Result> results = VCAPS::TailContributionEngine::compute(sim, probs);
+	EXPECT_EQ(2, results[0].tailYears);
+	EXPECT_NEAR(2., results[0].tvar, 1e-12);
+	EXPECT_NEAR(2., results[0].byRiskGroup.at("RG1"), 1e-12);
+}
+
+TEST_F(SimulationTests, Risk_Group_Flags) {
+	EXPECT_TRUE(VCAPS::RiskGroupTable::isTerror(VCAPS::RiskGroupTable::intern("RG1-Terr")));
+	EXPECT_TRUE(VCAPS::RiskGroupTable::isTerror(VCAPS::RiskGroupTable::intern("terr")));
+	EXPECT_FALSE(VCAPS::RiskGroupTable::isTerror(VCAPS::RiskGroupTable::intern("TER")));
+	EXPECT_FALSE(VCAPS::RiskGroupTable::isTerror(VCAPS::RiskGroupTable::intern("Terror")));
+	EXPECT_FALSE(VCAPS::RiskGroupTable::isNoncat(VCAPS::RiskGroupTable::intern("Noncat")));
+	EXPECT_TRUE(VCAPS::RiskGroupTable::isNoncat(VCAPS::RiskGroupTable::intern("Noncat-M1")));
+	EXPECT_FALSE(VCAPS::RiskGroupTable::isTerror(VCAPS::RiskGroupTable::na()));
+
+	// terror events merge into the event at their sequence id
+	VCAPS::VirtualEvent e(7, 5., 1., "RG1"), terror(8, 2., 0., "RG1-Terr");
+	e += terror;
+	EXPECT_NEAR(7., e.loss, 1e-12);
+	EXPECT_EQ(7, e.eventId());
+}
+
+TEST_F(SimulationTests, Noncat_Collisions) {
+	VCAPS::Simulation sim;
+	EXPECT_TRUE(sim.addVirtualEvent(1, 2005, VCAPS::VirtualEvent(7, 5., 0., "RG1")));
+	EXPECT_TRUE(sim.addVirtualEvent(1, 2503, VCAPS::VirtualEvent(8, 5., 0., "Noncat-A")));
+	int numSlots = VCAPS::NoncatSlots::last - VCAPS::NoncatSlots::first + 1;
+	for (int i = 1; i < numSlots; i++)
+		EXPECT_TRUE(sim.addVirtualEvent(1, 2005, VCAPS::VirtualEvent(100 + i, 1., 0., "Noncat-B")));
+	const VCAPS::VirtualEvent::MAP& events = sim.getIterations().at(1).get_events();
+	EXPECT_EQ(numSlots + 1, (int)events.size());
+	EXPECT_EQ(101, events.at(2501).eventId());
+	EXPECT_EQ(8, events.at(2503).eventId());
+	EXPECT_EQ(102, events.at(2502).eventId());
+	EXPECT_EQ(103, events.at(2504).eventId());
+	EXPECT_EQ(0, (int)events.count(2999));
+
+	// the same risk group adds up, the others have no id left
+	EXPECT_TRUE(sim.addVirtualEvent(1, 2005, VCAPS::VirtualEvent(7, 1., 0., "RG1")));
+	EXPECT_NEAR(6., sim.getIterations().at(1).get_events().at(2005).loss, 1e-12);
+	EXPECT_FALSE(sim.addVirtualEvent(1, 2005, VCAPS::VirtualEvent(99, 1., 0., "Noncat-C")));
+	EXPECT_EQ(numSlots + 1, (int)sim.countNumEvents());
+	EXPECT_TRUE(sim.addVirtualEvent(1, 3005, VCAPS::VirtualEvent(99, 1., 0., "Noncat-C")));
+
+	// combining reports the events with no id left
+	VCAPS::Simulation other;
+	other.addVirtualEvent(1, 2005, VCAPS::VirtualEvent(98, 1., 0., "Noncat-D"));
+	other.addVirtualEvent(2, 2005, VCAPS::VirtualEvent(98, 1., 0., "Noncat-D"));
+	VCAPS::Simulation added(sim), subtracted(sim), moved(sim), otherCopy(other);
+	string error;
+	EXPECT_FALSE(added.add(other, error));
+	EXPECT_EQ(0u, error.find("1 events dropped"));
+	EXPECT_FALSE(subtracted.subtract(other, error));
+	EXPECT_FALSE(moved.add(std::move(otherCopy), error));
+	EXPECT_EQ(sim.countNumEvents() + 1, added.countNumEvents());
+	error.clear();
+	EXPECT_TRUE(other.add(sim, error));
+	EXPECT_EQ("", error);
+
+	// different iteration counts fail and add nothing
+	VCAPS::Simulation tenIters(10), twentyIters(20);
+	tenIters.addVirtualEvent(1, 1, VCAPS::VirtualEvent(1, 1., 0., "RG1"));
+	twentyIters.addVirtualEvent(2, 1, VCAPS::VirtualEvent(2, 1., 0., "RG1"));
+	EXPECT_FALSE(tenIters.add(twentyIters, error));
+	EXPECT_NE(string::npos, error.find("_numIter"));
+	EXPECT_FALSE(tenIters.subtract(std::move(twentyIters), error));
+	EXPECT_EQ(1, tenIters.countNumEvents());
+	tenIters += twentyIters;
+	EXPECT_EQ(10, tenIters.get_numIter());
+	EXPECT_EQ(1, tenIters.countNumEvents());
+}
+
+//The threads started one after the other record in one buffer, and the
+//trace is written while a thread records
+TEST_F(SimulationTests, Trace_Buffers) {
+	string file = "/tmp/Simulation_test_trace.json";
+	VCAPS::Trace::start(file);
+	for (int t = 0; t < 50; t++)
+		thread([]() { TRACE_SCOPE("sequential"); }).join();
+	ASSERT_TRUE(VCAPS::Trace::write());
+	ifstream in(file.c_str());
+	stringstream trace;
+	trace << in.rdbuf();
+	size_t lanes = 0, sequential = 0;
+	for (size_t at = trace.str().find("thread_name"); at != string::npos; at = trace.str().find("thread_name", at + 1))
+		lanes++;
+	for (size_t at = trace.str().find("\"sequential\""); at != string::npos; at = trace.str().find("\"sequential\"", at + 1))
+		sequential++;
+	EXPECT_EQ(50u, sequential);
+	EXPECT_LE(lanes, 2u);
+
+	atomic<bool> stop(false);
+	thread busy([&stop]() {
+		while (!stop.load())
+			TRACE_SCOPE("busy");
+	});
+	for (int w = 0; w < 5; w++)
+		EXPECT_TRUE(VCAPS::Trace::write());
+	stop.store(true);
+	busy.join();
+	EXPECT_TRUE(VCAPS::Trace::write());
+}
@@ -53,8 +53,8 @@ TEST_F(DefaultVirtualYearTests, Add_Event_IDMatch) {
 	EXPECT_EQ(6, iE->second.get_lossNetOfReinstatePrem());
 	EXPECT_EQ(1, iE->second.reinstatementPrem);
 	EXPECT_EQ(0, iE->second.fullRip);
-	EXPECT_EQ("NA", iE->second.riskGroup);
-	EXPECT_EQ(0, iE->second.eventId);
+	EXPECT_EQ("NA", iE->second.riskGroup());
+	EXPECT_EQ(0, iE->second.eventId());
 
 	added_event = VCAPS::VirtualEvent();
 	default_year.addVirtualEvent(1, added_event);
@@ -64,8 +64,8 @@ TEST_F(DefaultVirtualYearTests, Add_Event_IDMatch) {
 	EXPECT_EQ(6, iE->second.get_lossNetOfReinstatePrem());
 	EXPECT_EQ(1, iE->second.reinstatementPrem);
 	EXPECT_EQ(0, iE->second.fullRip);
-	EXPECT_EQ("NA", iE->second.riskGroup);
-	EXPECT_EQ(0, iE->second.eventId);
+	EXPECT_EQ("NA", iE->second.riskGroup());
+	EXPECT_EQ(0, iE->second.eventId());
 
 	added_event = VCAPS::VirtualEvent(0,1,1);
 	default_year.addVirtualEvent(1, added_event);
@@ -76,8 +76,8 @@ TEST_F(DefaultVirtualYearTests, Add_Event_IDMatch) {
 	EXPECT_EQ(6, iE->second.get_lossNetOfReinstatePrem());
 	EXPECT_EQ(2, iE->second.reinstatementPrem);
 	EXPECT_EQ(0, iE->second.fullRip);
-	EXPECT_EQ("NA", iE->second.riskGroup);
-	EXPECT_EQ(0, iE->second.eventId);
+	EXPECT_EQ("NA", iE->second.riskGroup());
+	EXPECT_EQ(0, iE->second.eventId());
 
 }
 
@@ -93,8 +93,8 @@ TEST_F(DefaultVirtualYearTests, Add_Event) {
 	EXPECT_EQ(6, iE->second.get_lossNetOfReinstatePrem());
 	EXPECT_EQ(1, iE->second.reinstatementPrem);
 	EXPECT_EQ(0, iE->second.fullRip);
-	EXPECT_EQ("NA", iE->second.riskGroup);
-	EXPECT_EQ(0, iE->second.eventId);
+	EXPECT_EQ("NA", iE->second.riskGroup());
+	EXPECT_EQ(0, iE->second.eventId());
 
 	added_event = VCAPS::VirtualEvent(1, 1, 1);
 	default_year.addVirtualEvent(2, added_event);
@@ -105,15 +105,15 @@ TEST_F(DefaultVirtualYearTests, Add_Event) {
 	EXPECT_EQ(0, iE->second.get_lossNetOfReinstatePrem());
 	EXPECT_EQ(1, iE->second.reinstatementPrem);
 	EXPECT_EQ(0, iE->second.fullRip);
-	EXPECT_EQ("NA", iE->second.riskGroup);
-	EXPECT_EQ(1, iE->second.eventId);
+	EXPECT_EQ("NA", iE->second.riskGroup());
+	EXPECT_EQ(1, iE->second.eventId());
 	iE = default_year.get_events().find(1);
 	EXPECT_EQ(0, iE->second.ripBase);
 	EXPECT_EQ(6, iE->second.get_lossNetOfReinstatePrem());
 	EXPECT_EQ(1, iE->second.reinstatementPrem);
 	EXPECT_EQ(0, iE->second.fullRip);
-	EXPECT_EQ("NA", iE->second.riskGroup);
-	EXPECT_EQ(0, iE->second.eventId);
+	EXPECT_EQ("NA", iE->second.riskGroup());
+	EXPECT_EQ(0, iE->second.eventId());
 }
 
 //Replace an event with another event
@@ -128,8 +128,8 @@ TEST_F(DefaultVirtualYearTests, Update_Event) {
 	EXPECT_EQ(6, iE->second.get_lossNetOfReinstatePrem());
 	EXPECT_EQ(1, iE->second.reinstatementPrem);
 	EXPECT_EQ(0, iE->second.fullRip);
-	EXPECT_EQ("NA", iE->second.riskGroup);
-	EXPECT_EQ(0, iE->second.eventId);
+	EXPECT_EQ("NA", iE->second.riskGroup());
+	EXPECT_EQ(0, iE->second.eventId());
 
 	added_event = VCAPS::VirtualEvent(0, 1, 1);
 	default_year.updateVirtualEvent(1, added_event);
@@ -140,8 +140,8 @@ TEST_F(DefaultVirtualYearTests, Update_Event) {
 	EXPECT_EQ(0, iE->second.get_lossNetOfReinstatePrem());
 	EXPECT_EQ(1, iE->second.reinstatementPrem);
 	EXPECT_EQ(0, iE->second.fullRip);
-	EXPECT_EQ("NA", iE->second.riskGroup);
-	EXPECT_EQ(0, iE->second.eventId);
+	EXPECT_EQ("NA", iE->second.riskGroup());
+	EXPECT_EQ(0, iE->second.eventId());
 
 	added_event = VCAPS::VirtualEvent(1, 7., 1.);
 	default_year.updateVirtualEvent(1, added_event);
@@ -151,8 +151,8 @@ TEST_F(DefaultVirtualYearTests, Update_Event) {
 	EXPECT_EQ(6, iE->second.get_lossNetOfReinstatePrem());
 	EXPECT_EQ(1, iE->second.reinstatementPrem);
 	EXPECT_EQ(0, iE->second.fullRip);
-	EXPECT_EQ("NA", iE->second.riskGroup);
-	EXPECT_EQ(1, iE->second.eventId);
+	EXPECT_EQ("NA", iE->second.riskGroup());
+	EXPECT_EQ(1, iE->second.eventId());
 }
 
 //Delete an event and expect the size to decrease and to not find it when iterating
@@ -205,16 +205,16 @@ TEST_F(DefaultVirtualYearTests, PlusEq_Year) {
 	VCAPS::VirtualEvent::Iterator iE;
 	for (int i = 0; i < 4; i++){
 		iE = default_year.get_events().find(i);
-		EXPECT_EQ(i, iE->second.eventId);
+		EXPECT_EQ(i, iE->second.eventId());
 		EXPECT_EQ((i + 1) * 10 + (i + 1) * 100, iE->second.loss);
 		EXPECT_EQ(long((i + 1)*1.1) , long(iE->second.reinstatementPrem));
-		EXPECT_EQ("NA", iE->second.riskGroup);
+		EXPECT_EQ("NA", iE->second.riskGroup());
 	}
 	iE = default_year.get_events().find(4);
-	EXPECT_EQ(4, iE->second.eventId);
+	EXPECT_EQ(4, iE->second.eventId());
 	EXPECT_EQ(4, iE->second.loss);
 	EXPECT_EQ(long double(4), long double(iE->second.reinstatementPrem));
-	EXPECT_EQ("NA", iE->second.riskGroup);	
+	EXPECT_EQ("NA", iE->second.riskGroup());	
 }
 
 //Subtract equal year 
@@ -241,16 +241,16 @@ TEST_F(DefaultVirtualYearTests, SubEq_Year) {
 	VCAPS::VirtualEvent::Iterator iE;
 	for (int i = 0; i < 4; i++){
 		iE = default_year.get_events().find(i);
-		EXPECT_EQ(i, iE->second.eventId);
+		EXPECT_EQ(i, iE->second.eventId());
 		EXPECT_EQ((i + 1) * 10 - (i + 1) * 100, iE->second.loss);
 		EXPECT_EQ(long double((i+1)*0.9), long double(iE->second.reinstatementPrem));
-		EXPECT_EQ("NA", iE->second.riskGroup);
+		EXPECT_EQ("NA", iE->second.riskGroup());
 	}
 	iE = default_year.get_events().find(4);
-	EXPECT_EQ(4, iE->second.eventId);
+	EXPECT_EQ(4, iE->second.eventId());
 	EXPECT_EQ(-4, iE->second.loss);
 	EXPECT_EQ(long double(-4), long double(iE->second.reinstatementPrem));
-	EXPECT_EQ("NA", iE->second.riskGroup);
+	EXPECT_EQ("NA", iE->second.riskGroup());
 }
 
 //Make sure we can accexx events directly using operator
@@ -265,17 +265,17 @@ TEST_F(DefaultVirtualYearTests, Array_Operator) {
 	EXPECT_EQ(4, default_year.size());
 
 	for (int i = 0; i < 4; i++){
-		EXPECT_EQ(i, default_year[i].eventId);
+		EXPECT_EQ(i, default_year[i].eventId());
 		EXPECT_EQ((i + 1) * 10, default_year[i].loss);
 		EXPECT_EQ(long double(i + 1), long double(default_year[i].reinstatementPrem));
-		EXPECT_EQ("NA", default_year[i].riskGroup);
+		EXPECT_EQ("NA", default_year[i].riskGroup());
 	}
 
 	for (int i = 3; i >= 0; i--){
-		EXPECT_EQ(i, default_year[i].eventId);
+		EXPECT_EQ(i, default_year[i].eventId());
 		EXPECT_EQ((i + 1) * 10, default_year[i].loss);
 		EXPECT_EQ(long double(i + 1), long double(default_year[i].reinstatementPrem));
-		EXPECT_EQ("NA", default_year[i].riskGroup);
+		EXPECT_EQ("NA", default_year[i].riskGroup());
 	}
 }
 
@@ -291,15 +291,15 @@ TEST_F(DefaultVirtualYearTests, FilterEvent) {
 	EXPECT_EQ(40000, default_year.size());
 
 	for (int i = 0; i < 40000; i++){
-		EXPECT_EQ(i, default_year[i].eventId);
+		EXPECT_EQ(i, default_year[i].eventId());
 		EXPECT_EQ((i), default_year[i].loss);
 		EXPECT_EQ(long double((39999 - i) * 0.0001), long double(default_year[i].reinstatementPrem));
-		EXPECT_EQ("NA", default_year[i].riskGroup);
+		EXPECT_EQ("NA", default_year[i].riskGroup());
 	}
 	default_year.filterOutEvent(20000, "NA");
 	EXPECT_EQ(20000, default_year.size());
 	for (int i = 20000; i < 40000; i++){
-		EXPECT_EQ(i, default_year[i].eventId);
+		EXPECT_EQ(i, default_year[i].eventId());
 		EXPECT_EQ((i), default_year[i].loss);
 		if (long double (fabs((39999 - i) * 0.0001)) < 1){
 			EXPECT_EQ(long double(0), long double(default_year[i].reinstatementPrem));
@@ -307,7 +307,7 @@ TEST_F(DefaultVirtualYearTests, FilterEvent) {
 		else{
 			EXPECT_EQ(long double((39999 - i) * 0.0001), long double(default_year[i].reinstatementPrem));
 		}
-		EXPECT_EQ("NA", default_year[i].riskGroup);
+		EXPECT_EQ("NA", default_year[i].riskGroup());
 	}
 }
 
@@ -323,20 +323,20 @@ TEST_F(DefaultVirtualYearTests, copyWithFilter) {
 	EXPECT_EQ(40000, added_year.size());
 
 	for (int i = 0; i < 40000; i++){
-		EXPECT_EQ(i, added_year[i].eventId);
+		EXPECT_EQ(i, added_year[i].eventId());
 		EXPECT_EQ((i), added_year[i].loss);
 		EXPECT_EQ(long double((39999 - i) * 0.0001), long double(added_year[i].reinstatementPrem));
-		EXPECT_EQ("NA", added_year[i].riskGroup);
+		EXPECT_EQ("NA", added_year[i].riskGroup());
 	}
 	int i = 0;
 	default_year.copyWithFilter(added_year,20000,2.0, i);
 	EXPECT_EQ(20000, default_year.size());
 
 	for (int i = 20000; i < 40000; i++){
-		EXPECT_EQ(i, default_year[i].eventId);
+		EXPECT_EQ(i, default_year[i].eventId());
 		EXPECT_EQ((i)*2, default_year[i].loss);
 		EXPECT_EQ(long double((39999 - i) * 0.0001), long double(added_year[i].reinstatementPrem));
-		EXPECT_EQ("NA", default_year[i].riskGroup);
+		EXPECT_EQ("NA", default_year[i].riskGroup());
 	}
 }
 
@@ -352,10 +352,10 @@ TEST_F(DefaultVirtualYearTests, addNoncatVirtualYear) {
 	}
 	EXPECT_EQ(40000, added_year.size());
 	for (int i = 0; i < 40000; i++){
-		EXPECT_EQ(i, added_year[i].eventId);
+		EXPECT_EQ(i, added_year[i].eventId());
 		EXPECT_EQ((i), added_year[i].loss);
 		EXPECT_EQ(long double((39999 - i) * 0.0001), long double(added_year[i].reinstatementPrem));
-		EXPECT_EQ("NA", added_year[i].riskGroup);
+		EXPECT_EQ("NA", added_year[i].riskGroup());
 	}
 }
 
@@ -391,10 +391,10 @@ TEST_F(VirtualYearMapTest, ensure_initial) {
 		year_iE = year_map.find(j);
 		for (int i = 0; i < 10; i++){
 			event_iE = year_iE->second.get_events().find(i);
-			EXPECT_EQ(i, event_iE->second.eventId);
+			EXPECT_EQ(i, event_iE->second.eventId());
 			EXPECT_EQ((i), event_iE->second.loss);
 			EXPECT_EQ(long double((39999 - i) * 0.0001), long double(event_iE->second.reinstatementPrem));
-			EXPECT_EQ("NA", event_iE->second.riskGroup);
+			EXPECT_EQ("NA", event_iE->second.riskGroup());
 		}
 	}
 	t2 = high_resolution_clock::now();
@@ -419,10 +419,10 @@ TEST_F(VirtualYearMapTest, copy_year_map) {
 		year_iE = year_map_copy.find(j);
 		for (int i = 0; i < 10; i++){
 			event_iE = year_iE->second.get_events().find(i);
-			EXPECT_EQ(i, event_iE->second.eventId);
+			EXPECT_EQ(i, event_iE->second.eventId());
 			EXPECT_EQ((i), event_iE->second.loss);
 			EXPECT_EQ(long double((39999 - i) * 0.0001), long double(event_iE->second.reinstatementPrem));
-			EXPECT_EQ("NA", event_iE->second.riskGroup);
+			EXPECT_EQ("NA", event_iE->second.riskGroup());
 		}
 	}
 	t2 = high_resolution_clock::now();